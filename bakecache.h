@@ -0,0 +1,296 @@
+//
+//  File: bakecache.h
+//
+//  Description:
+//    On disk cache of the node's per frame results. The translation the node
+//    carries in transX/Y/Z only comes out right when frames are evaluated in
+//    order, so a bake records every evaluated frame and playback reads any
+//    frame back without running the kernel. Records have a fixed size, the
+//    file is mapped for playback and a frame is found with one lookup.
+//
+//    The file is a header, the vertex count of every geometry, then one
+//    record per frame: the frame number, three floats of translation per
+//    geometry and, when points are kept, three floats per vertex of every
+//    geometry one after the other. Recording a frame again overwrites it.
+//
+
+#ifndef BAKECACHE_H
+#define BAKECACHE_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class BakeCache
+{
+public:
+   BakeCache() : fd(-1), writing(false), map(NULL), mapBytes(0), mapTime(0), numRecords(0), numGeometries(0),
+      totalPoints(0), withPoints(false), recordBytes(0), dataStart(0), firstFrame(0) {}
+   ~BakeCache() { close(); }
+
+   //opens path for recording geometries of the given vertex counts. Records
+   //already in the file are kept when it has the same layout, otherwise the
+   //file starts over. Does nothing when already recording that layout there
+   bool beginRecord(const char* path, int geometries, const int* numPoints, bool points)
+   {
+      if (writing && fileName == path && sameLayout(geometries, numPoints, points)) {
+         return true;
+      }
+      close();
+      setLayout(geometries, numPoints, points);
+      fd = ::open(path, O_RDWR | O_CREAT, 0644);
+      if (fd < 0) {
+         return false;
+      }
+      writing = true;
+      fileName = path;
+
+      //an existing file of the same layout keeps its whole records
+      std::vector<char> header, existing(dataStart);
+      writeHeader(header);
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size >= (off_t)dataStart
+         && pread(fd, &existing[0], dataStart, 0) == (ssize_t)dataStart && existing == header) {
+         long records = (info.st_size - dataStart) / recordBytes;
+         for (long r = 0; r < records; r++) {
+            int frame;
+            if (pread(fd, &frame, sizeof(int), dataStart + r * recordBytes) != sizeof(int)) {
+               records = r;
+               break;
+            }
+            indexRecord(frame, r);
+         }
+         numRecords = records;
+         return ftruncate(fd, dataStart + records * recordBytes) == 0;
+      }
+      return ftruncate(fd, 0) == 0 && pwrite(fd, &header[0], dataStart, 0) == (ssize_t)dataStart;
+   }
+
+   //writes the record of one frame. moves holds three floats per geometry,
+   //points three floats per vertex or NULL when the layout keeps no points
+   bool record(int frame, const float* moves, const float* points)
+   {
+      if (!writing) {
+         return false;
+      }
+      long r = recordOf(frame);
+      if (r < 0) {
+         r = numRecords;
+         if (!indexRecord(frame, r)) {
+            return false;
+         }
+         numRecords++;
+      }
+      recordBuffer.assign(recordBytes, 0);
+      char* out = &recordBuffer[0];
+      memcpy(out, &frame, sizeof(int));
+      memcpy(out + RECORD_HEADER, moves, sizeof(float) * 3 * numGeometries);
+      if (withPoints) {
+         memcpy(out + RECORD_HEADER + sizeof(float) * 3 * numGeometries, points, sizeof(float) * 3 * totalPoints);
+      }
+      return pwrite(fd, out, recordBytes, dataStart + r * recordBytes) == (ssize_t)recordBytes;
+   }
+
+   //maps path for playback and indexes its records. Does nothing when path
+   //is already mapped and has not changed on disk since
+   bool beginPlayback(const char* path)
+   {
+      struct stat info;
+      if (stat(path, &info) != 0) {
+         close();
+         return false;
+      }
+      if (map && fileName == path && (size_t)info.st_size == mapBytes && info.st_mtime == mapTime) {
+         return true;
+      }
+      close();
+      fd = ::open(path, O_RDONLY);
+      if (fd < 0) {
+         return false;
+      }
+      fileName = path;
+      mapBytes = info.st_size;
+      mapTime = info.st_mtime;
+      void* mapped = mapBytes > 0 ? mmap(NULL, mapBytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+      if (mapped == MAP_FAILED) {
+         close();
+         return false;
+      }
+      map = (const char*)mapped;
+      if (!readLayout()) {
+         close();
+         return false;
+      }
+
+      //a partly written last record is left out
+      numRecords = (mapBytes - dataStart) / recordBytes;
+      for (long r = 0; r < numRecords; r++) {
+         int frame;
+         memcpy(&frame, map + dataStart + r * recordBytes, sizeof(int));
+         indexRecord(frame, r);
+      }
+      return true;
+   }
+
+   //whether the mapped file was recorded for geometries of these vertex counts
+   bool matches(int geometries, const int* numPoints, bool points) const
+   {
+      return map && sameLayout(geometries, numPoints, points);
+   }
+
+   //translation of every geometry in the record of frame, NULL when the
+   //frame was not recorded
+   const float* moves(int frame) const
+   {
+      const char* r = find(frame);
+      return r ? (const float*)(r + RECORD_HEADER) : NULL;
+   }
+
+   //points of every geometry in the record of frame, NULL when the frame was
+   //not recorded or the file keeps no points
+   const float* points(int frame) const
+   {
+      const char* r = withPoints ? find(frame) : NULL;
+      return r ? (const float*)(r + RECORD_HEADER + sizeof(float) * 3 * numGeometries) : NULL;
+   }
+
+   //number of frames recorded or mapped
+   long frames() const { return numRecords; }
+
+   bool recording() const { return writing; }
+   bool playing() const { return map != NULL; }
+
+   void close()
+   {
+      if (map) {
+         munmap((void *)map, mapBytes);
+      }
+      if (fd >= 0) {
+         ::close(fd);
+      }
+      fd = -1;
+      writing = false;
+      map = NULL;
+      mapBytes = 0;
+      numRecords = 0;
+      fileName.clear();
+      frameRecord.clear();
+   }
+
+private:
+   //the records start on an 8 byte boundary behind the frame number and
+   //padding. Frames further apart than MAX_FRAME_SPAN are not indexed
+   enum { VERSION = 1, MAGIC_BYTES = 8, RECORD_HEADER = 8, MAX_FRAME_SPAN = 1 << 24 };
+
+   static const char* magic() { return "MAGBAKE"; }
+
+   void setLayout(int geometries, const int* numPoints, bool points)
+   {
+      numGeometries = geometries;
+      counts.assign(numPoints, numPoints + geometries);
+      totalPoints = 0;
+      for (int g = 0; g < geometries; g++) {
+         totalPoints += numPoints[g];
+      }
+      withPoints = points;
+      recordBytes = RECORD_HEADER + sizeof(float) * 3 * (numGeometries + (withPoints ? totalPoints : 0));
+      recordBytes = (recordBytes + 7) & ~(size_t)7;
+      dataStart = (MAGIC_BYTES + sizeof(int) * (3 + numGeometries) + 7) & ~(size_t)7;
+   }
+
+   bool sameLayout(int geometries, const int* numPoints, bool points) const
+   {
+      return geometries == numGeometries && points == withPoints
+         && std::equal(numPoints, numPoints + geometries, counts.begin());
+   }
+
+   //magic, version, geometry count, points flag, then the vertex counts
+   void writeHeader(std::vector<char>& header) const
+   {
+      header.assign(dataStart, 0);
+      int fields[3] = {VERSION, numGeometries, withPoints ? 1 : 0};
+      memcpy(&header[0], magic(), MAGIC_BYTES);
+      memcpy(&header[MAGIC_BYTES], fields, sizeof(fields));
+      if (numGeometries > 0) {
+         memcpy(&header[MAGIC_BYTES + sizeof(fields)], &counts[0], sizeof(int) * numGeometries);
+      }
+   }
+
+   bool readLayout()
+   {
+      int fields[3];
+      if (mapBytes < MAGIC_BYTES + sizeof(fields) || memcmp(map, magic(), MAGIC_BYTES) != 0) {
+         return false;
+      }
+      memcpy(fields, map + MAGIC_BYTES, sizeof(fields));
+      if (fields[0] != VERSION || fields[1] < 0
+         || mapBytes < MAGIC_BYTES + sizeof(fields) + sizeof(int) * (size_t)fields[1]) {
+         return false;
+      }
+      std::vector<int> numPoints(fields[1] + 1);
+      memcpy(&numPoints[0], map + MAGIC_BYTES + sizeof(fields), sizeof(int) * fields[1]);
+      setLayout(fields[1], &numPoints[0], fields[2] != 0);
+      return mapBytes >= dataStart;
+   }
+
+   //remembers that frame lives in record r, a later record of a frame wins
+   bool indexRecord(int frame, long r)
+   {
+      if (frameRecord.empty()) {
+         firstFrame = frame;
+      }
+      long lo = frame < firstFrame ? frame : firstFrame;
+      long hi = frame - firstFrame >= (long)frameRecord.size() ? frame : firstFrame + (long)frameRecord.size() - 1;
+      if (hi - lo >= MAX_FRAME_SPAN) {
+         return false;
+      }
+      if (frame < firstFrame) {
+         frameRecord.insert(frameRecord.begin(), firstFrame - frame, -1);
+         firstFrame = frame;
+      }
+      if (frame - firstFrame >= (long)frameRecord.size()) {
+         frameRecord.resize(frame - firstFrame + 1, -1);
+      }
+      frameRecord[frame - firstFrame] = r;
+      return true;
+   }
+
+   long recordOf(int frame) const
+   {
+      long f = (long)frame - firstFrame;
+      return f >= 0 && f < (long)frameRecord.size() ? frameRecord[f] : -1;
+   }
+
+   const char* find(int frame) const
+   {
+      long r = map ? recordOf(frame) : -1;
+      return r >= 0 ? map + dataStart + r * recordBytes : NULL;
+   }
+
+   std::string fileName;
+   int fd;
+   bool writing;                //opened by beginRecord
+   const char* map;             //whole file while playing back
+   size_t mapBytes;
+   time_t mapTime;              //modification time of the mapped file
+   long numRecords;
+
+   int numGeometries;
+   std::vector<int> counts;     //vertex count of every geometry
+   int totalPoints;
+   bool withPoints;
+   size_t recordBytes;
+   size_t dataStart;            //offset of the first record
+
+   int firstFrame;                  //frame of frameRecord[0]
+   std::vector<long> frameRecord;   //record of every frame from firstFrame on, -1 if not recorded
+   std::vector<char> recordBuffer;  //one record while it is written
+};
+
+#endif
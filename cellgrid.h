@@ -0,0 +1,276 @@
+//
+//  File: cellgrid.h
+//
+//  Description:
+//    Uniform grid over the magnet vertices for a fixed influence radius. The
+//    influence of a magnet vertex falls off with the square of its distance,
+//    so past some radius it is negligible. Binning the magnet into cells of
+//    that size means a query only visits the cells around it, and the work
+//    follows the local vertex density instead of the magnet's size.
+//
+//    The pairs themselves run through the dispatched rowWithin and
+//    columnWithin kernels of magnetcore.h, handed in as function pointers so
+//    the grid only decides which runs of points meet.
+//
+
+#ifndef CELLGRID_H
+#define CELLGRID_H
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+class CellGrid
+{
+public:
+   CellGrid() : count(0), radius(0), cellSize(0) {}
+
+   //bins numPoints planar points (all x, then all y, then all z) with one
+   //weight each for queries of the given radius, both inputs are copied
+   void build(const double* points, const double* weights, int numPoints, double influenceRadius)
+   {
+      count = numPoints;
+      radius = influenceRadius;
+      px.resize(count);
+      py.resize(count);
+      pz.resize(count);
+      wts.resize(count);
+      idx.resize(count);
+      cellStart.clear();
+      if (count == 0 || radius <= 0) {
+         count = 0;
+         return;
+      }
+
+      for (int a = 0; a < 3; a++) {
+         origin[a] = DBL_MAX;
+         upper[a] = -DBL_MAX;
+      }
+      for (int i = 0; i < count; i++) {
+         for (int a = 0; a < 3; a++) {
+            double v = points[a * count + i];
+            origin[a] = v < origin[a] ? v : origin[a];
+            upper[a] = v > upper[a] ? v : upper[a];
+         }
+      }
+
+      //cells are one radius wide so a query covers at most 3x3x3 of them,
+      //unless that would need far more cells than points
+      cellSize = radius;
+      for (;;) {
+         double cells = 1;
+         for (int a = 0; a < 3; a++) {
+            cells *= floor((upper[a] - origin[a]) / cellSize) + 1;
+         }
+         if (cells <= (double)MAX_CELLS_PER_POINT * count + 64) {
+            break;
+         }
+         cellSize *= 2;
+      }
+      for (int a = 0; a < 3; a++) {
+         dims[a] = (int)((upper[a] - origin[a]) / cellSize) + 1;
+      }
+
+      //counting sort of the points into their cells
+      int numCells = dims[0] * dims[1] * dims[2];
+      cellStart.assign(numCells + 1, 0);
+      std::vector<int> cellOf(count);
+      for (int i = 0; i < count; i++) {
+         int c[3];
+         for (int a = 0; a < 3; a++) {
+            c[a] = cellIndex(points[a * count + i], a);
+         }
+         cellOf[i] = (c[2] * dims[1] + c[1]) * dims[0] + c[0];
+         cellStart[cellOf[i] + 1]++;
+      }
+      for (int c = 0; c < numCells; c++) {
+         cellStart[c + 1] += cellStart[c];
+      }
+      std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+      for (int i = 0; i < count; i++) {
+         idx[fill[cellOf[i]]++] = i;
+      }
+
+      for (int k = 0; k < count; k++) {
+         px[k] = points[idx[k]];
+         py[k] = points[count + idx[k]];
+         pz[k] = points[2 * count + idx[k]];
+         wts[k] = weights[idx[k]];
+      }
+   }
+
+   //replaces the weights of the points the grid was built from, the cells
+   //stay as they are
+   void reweight(const double* weights)
+   {
+      for (int k = 0; k < count; k++) {
+         wts[k] = weights[idx[k]];
+      }
+   }
+
+   void clear()
+   {
+      count = 0;
+      radius = 0;
+      cellStart.clear();
+   }
+
+   int size() const { return count; }
+
+   //radius the grid was built for, 0 when it is empty
+   double influenceRadius() const { return count > 0 ? radius : 0; }
+
+   //InverseSquareKernels<double>::rowWithin and columnWithin
+   typedef double (*RowWithin)(double, double, double, double const*, double const*, double const*, int,
+      double);
+   typedef void (*ColumnWithin)(double, double, double, double const*, double const*, double const*,
+      double const*, int, double, double*);
+
+   int numCells() const { return count > 0 ? (int)cellStart.size() - 1 : 0; }
+
+   //cell q falls in, points outside the grid go to the closest cell
+   int cellOf(const double* q) const
+   {
+      return (cellIndex(q[2], 2) * dims[1] + cellIndex(q[1], 1)) * dims[0] + cellIndex(q[0], 0);
+   }
+
+   //whether every point of the grid is closer than the radius to every point
+   //of the box lo..hi, the cutoff then skips no pair in it
+   bool covers(const double* lo, const double* hi) const
+   {
+      double farSq = 0;
+      for (int a = 0; a < 3; a++) {
+         double far = hi[a] - origin[a] > upper[a] - lo[a] ? hi[a] - origin[a] : upper[a] - lo[a];
+         farSq += far * far;
+      }
+      return count > 0 && farSq < radius * radius;
+   }
+
+   //sum of weight / dist^2 over the pairs of a grid point and one of n
+   //planar query points (x, y and z arrays) closer than the radius. The
+   //queries lie in the box lo..hi, grid points further than the radius from
+   //the box are skipped, rowWithin runs over the queries for the others
+   double inverseSquareBox(const double* lo, const double* hi, const double* x, const double* y, const double* z,
+      int n, RowWithin rowWithin) const
+   {
+      double sum = 0;
+      const double radiusSq = radius * radius;
+      int clo[3], chi[3];
+      if (!cellRange(lo, hi, clo, chi)) {
+         return 0;
+      }
+      for (int cz = clo[2]; cz <= chi[2]; cz++) {
+         for (int cy = clo[1]; cy <= chi[1]; cy++) {
+            //the cells of one row are consecutive in grid order
+            int row = (cz * dims[1] + cy) * dims[0];
+            int end = cellStart[row + chi[0] + 1];
+            for (int k = cellStart[row + clo[0]]; k < end; k++) {
+               if (boxGapSq(lo, hi, px[k], py[k], pz[k]) < radiusSq) {
+                  sum += wts[k] * rowWithin(px[k], py[k], pz[k], x, y, z, n, radiusSq);
+               }
+            }
+         }
+      }
+      return sum;
+   }
+
+   //number of points inverseSquareBox would run rowWithin for
+   int pointsNear(const double* lo, const double* hi) const
+   {
+      int near = 0;
+      const double radiusSq = radius * radius;
+      int clo[3], chi[3];
+      if (!cellRange(lo, hi, clo, chi)) {
+         return 0;
+      }
+      for (int cz = clo[2]; cz <= chi[2]; cz++) {
+         for (int cy = clo[1]; cy <= chi[1]; cy++) {
+            int row = (cz * dims[1] + cy) * dims[0];
+            int end = cellStart[row + chi[0] + 1];
+            for (int k = cellStart[row + clo[0]]; k < end; k++) {
+               near += boxGapSq(lo, hi, px[k], py[k], pz[k]) < radiusSq;
+            }
+         }
+      }
+      return near;
+   }
+
+   //vector field weight * (q - p) / dist^3 over every point closer than the
+   //radius, see Octree::inverseSquareField. columnWithin runs over the cell
+   //rows around q
+   void inverseSquareField(const double* q, ColumnWithin columnWithin, double* field) const
+   {
+      field[0] = field[1] = field[2] = 0;
+      int lo[3], hi[3];
+      if (!cellRange(q, q, lo, hi)) {
+         return;
+      }
+      for (int cz = lo[2]; cz <= hi[2]; cz++) {
+         for (int cy = lo[1]; cy <= hi[1]; cy++) {
+            int row = (cz * dims[1] + cy) * dims[0];
+            int first = cellStart[row + lo[0]];
+            int end = cellStart[row + hi[0] + 1];
+            if (end > first) {
+               double f[3];
+               columnWithin(q[0], q[1], q[2], &px[first], &py[first], &pz[first], &wts[first], end - first,
+                  radius * radius, f);
+               field[0] += f[0];
+               field[1] += f[1];
+               field[2] += f[2];
+            }
+         }
+      }
+   }
+
+private:
+   //upper bound on the number of cells per point, sparse magnets get wider cells
+   enum { MAX_CELLS_PER_POINT = 8 };
+
+   //squared distance between the box lo..hi and the point (x, y, z)
+   static double boxGapSq(const double* lo, const double* hi, double x, double y, double z)
+   {
+      double p[3] = {x, y, z}, gapSq = 0;
+      for (int a = 0; a < 3; a++) {
+         double d = p[a] < lo[a] ? lo[a] - p[a] : p[a] > hi[a] ? p[a] - hi[a] : 0;
+         gapSq += d * d;
+      }
+      return gapSq;
+   }
+
+   int cellIndex(double v, int a) const
+   {
+      int c = (int)((v - origin[a]) / cellSize);
+      return c < 0 ? 0 : c >= dims[a] ? dims[a] - 1 : c;
+   }
+
+   //cells within the radius of the box boxLo..boxHi, false if none is
+   bool cellRange(const double* boxLo, const double* boxHi, int* lo, int* hi) const
+   {
+      if (count == 0) {
+         return false;
+      }
+      for (int a = 0; a < 3; a++) {
+         double from = (boxLo[a] - radius - origin[a]) / cellSize;
+         double to = (boxHi[a] + radius - origin[a]) / cellSize;
+         if (to < 0 || from >= dims[a]) {
+            return false;
+         }
+         lo[a] = from < 0 ? 0 : (int)from;
+         hi[a] = to >= dims[a] ? dims[a] - 1 : (int)to;
+      }
+      return true;
+   }
+
+   int count;
+   double radius;                //influence radius the grid was built for
+   double cellSize;              //edge length of a cell, at least radius
+   double origin[3];             //lowest corner of cell 0, the smallest coordinates of the points
+   double upper[3];              //largest coordinates of the points
+   int dims[3];                  //number of cells along each axis
+   std::vector<int> cellStart;   //first point of every cell in grid order, then count
+   std::vector<double> px, py, pz;   //planar points in grid order
+   std::vector<double> wts;      //weights in grid order
+   std::vector<int> idx;         //original index of each point in grid order
+};
+
+#endif
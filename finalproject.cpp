@@ -10,23 +10,32 @@
 
 #include <maya/MIOStream.h>
 
-#include <maya/MPxDeformerNode.h> 
 #include <maya/MItGeometry.h>
 #include <maya/MFnPlugin.h>
 #include <maya/MDataBlock.h>
 #include <maya/MDataHandle.h>
 #include <maya/MPoint.h>
-#include <maya/MTimer.h>
 #include <maya/MFnMesh.h>
 #include <maya/MPointArray.h>
 #include <maya/MFnNumericAttribute.h>
 #include <maya/MFnTypedAttribute.h>
+#include <maya/MFnCompoundAttribute.h>
+#include <maya/MFnEnumAttribute.h>
+#include <maya/MFnUnitAttribute.h>
+#include <maya/MTime.h>
+#include <maya/MArrayDataHandle.h>
 #include <maya/MFnMeshData.h>
+#include <maya/MPxCommand.h>
+#include <maya/MArgList.h>
+#include <maya/MSelectionList.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MStringArray.h>
 
 #include <maya/MThreadUtils.h>
+#include <maya/MGlobal.h>
+#include <maya/MRenderUtil.h>
 
 #include "finalproject.h"
-#include "float.h"
 #include "math.h"
 
 // Macros
@@ -37,45 +46,31 @@
 		return status;					\
 	}
 
-class finalproject : public MPxDeformerNode
-{
-public:
-						finalproject();
-	virtual				~finalproject();
-
-	static  void*		creator();
-	static  MStatus		initialize();
-
-	// deformation function
-	//
-	virtual MStatus compute(const MPlug& plug, MDataBlock& dataBlock);
-
-public:
-	// local node attributes
-
-	static  MTypeId		id;
-
-	static MObject deformingMesh;  
-	static MObject transX; //attribute to store x-value of object center after moved by the magnet
-	static MObject transY; //attribute to store y-value of object center after moved by the magnet
-	static MObject transZ; //attribute to store z-value of object center after moved by the magnet
-	static MObject offload; //attribute to toggle Xeon Phi offload
-	static MObject tesla;   //attribute representing magnetic strength value
-	static MObject positivelycharged;  //attribute representing polarity of the object
-
-private:
-};
-
 MTypeId     finalproject::id( 0x8104D );
+MObject		finalproject::magnets;
 MObject		finalproject::deformingMesh;
+MObject		finalproject::magnetStrength;
+MObject		finalproject::magnetReversed;
 MObject		finalproject::transX;
 MObject		finalproject::transY;
 MObject		finalproject::transZ;
+MObject		finalproject::storedTranslation;
 MObject		finalproject::offload;
+MObject		finalproject::singlePrecision;
 MObject     finalproject::tesla;
+MObject     finalproject::openingAngle;
+MObject     finalproject::influenceRadius;
+MObject     finalproject::maxSubsteps;
+MObject     finalproject::levelOfDetail;
+MObject     finalproject::proxyVertices;
 MObject     finalproject::positivelycharged;
+MObject     finalproject::profile;
+MObject     finalproject::deformMode;
+MObject     finalproject::time;
+MObject     finalproject::bakeMode;
+MObject     finalproject::bakeFile;
 
-finalproject::finalproject() {}
+finalproject::finalproject() : numMagnetInputs(0), numGeometryInputs(0), cutoffWarned(false) {}
 finalproject::~finalproject() {}
 
 void* finalproject::creator()
@@ -90,6 +85,38 @@ MStatus finalproject::initialize()
 	MFnTypedAttribute mAttr;
  	deformingMesh=mAttr.create( "deformingMesh", "dm", MFnMeshData::kMesh);
  	
+ 	//every element of the magnets array is one magnet, all of them act on
+ 	//the object in the same pass
+ 	MFnNumericAttribute nAttrM;
+ 	magnetStrength=nAttrM.create( "magnetStrength", "ms", MFnNumericData::kDouble);
+ 	nAttrM.setStorable(true);
+ 	nAttrM.setKeyable(true);
+ 	nAttrM.setDefault(1.0);
+ 	nAttrM.setMin(0.0);
+ 	nAttrM.setSoftMax(10.0);
+ 	
+ 	magnetReversed=nAttrM.create( "magnetReversed", "mr", MFnNumericData::kBoolean);
+ 	nAttrM.setStorable(true);
+ 	nAttrM.setKeyable(true);
+ 	nAttrM.setDefault(false);
+ 	
+ 	MFnCompoundAttribute cAttr;
+ 	magnets=cAttr.create( "magnets", "mgs");
+ 	cAttr.addChild(deformingMesh);
+ 	cAttr.addChild(magnetStrength);
+ 	cAttr.addChild(magnetReversed);
+ 	cAttr.setArray(true);
+ 	cAttr.setIndexMatters(false);
+ 	
+ 	//profiling does not change the result, so it does not affect outputGeom
+ 	MFnNumericAttribute nAttrP;
+ 	profile=nAttrP.create( "profile", "prf", MFnNumericData::kBoolean);
+ 	nAttrP.setStorable(true);
+ 	nAttrP.setDefault(false);
+ 	
+ 	status = addAttribute( profile );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+ 	
  	MFnNumericAttribute nAttrt;
  	transX = nAttrt.create( "transX", "tx", MFnNumericData::kDouble);
  	nAttrt.setStorable(true);
@@ -118,6 +145,20 @@ MStatus finalproject::initialize()
  	status = attributeAffects( transZ, outputGeom );
 	MCheckStatus(status, "ERROR in attributeAffects\n");
 	
+	//compute writes the translation of every geometry here so it is saved with
+	//the scene, and a node that has not evaluated yet (a reopened scene or a
+	//duplicate) starts from it. Nothing affects it, it is only written
+	//alongside outputGeom
+	MFnNumericAttribute nAttrS;
+	storedTranslation = nAttrS.create( "storedTranslation", "stt", MFnNumericData::k3Double);
+	nAttrS.setArray(true);
+	nAttrS.setUsesArrayDataBuilder(true);
+	nAttrS.setStorable(true);
+	nAttrS.setKeyable(false);
+	
+ 	status = addAttribute( storedTranslation );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+	
 	tesla = nAttrt.create( "tesla", "tes", MFnNumericData::kDouble);
 	nAttrt.setStorable(true);
 	nAttrt.setKeyable(true);
@@ -131,6 +172,48 @@ MStatus finalproject::initialize()
  	status = attributeAffects( tesla, outputGeom );
 	MCheckStatus(status, "ERROR in attributeAffects\n");
 	
+	openingAngle = nAttrt.create( "openingAngle", "oa", MFnNumericData::kDouble);
+	nAttrt.setStorable(true);
+	nAttrt.setKeyable(true);
+	nAttrt.setDefault(0.0);
+	nAttrt.setMin(0.0);
+	nAttrt.setSoftMax(1.0);
+	
+ 	status = addAttribute( openingAngle );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( openingAngle, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+	
+	//pairs further apart than the radius are skipped, 0 keeps all of them
+	influenceRadius = nAttrt.create( "influenceRadius", "ir", MFnNumericData::kDouble);
+	nAttrt.setStorable(true);
+	nAttrt.setKeyable(true);
+	nAttrt.setDefault(0.0);
+	nAttrt.setMin(0.0);
+	nAttrt.setSoftMax(10.0);
+	
+ 	status = addAttribute( influenceRadius );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( influenceRadius, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+	
+	//an object close to the magnet splits its translation into up to this many
+	//shorter steps, 1 moves every object in one step
+	maxSubsteps = nAttrt.create( "maxSubsteps", "mxs", MFnNumericData::kInt);
+	nAttrt.setStorable(true);
+	nAttrt.setKeyable(true);
+	nAttrt.setDefault(1);
+	nAttrt.setMin(1);
+	nAttrt.setSoftMax(16);
+	
+ 	status = addAttribute( maxSubsteps );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( maxSubsteps, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+	
    positivelycharged = nAttrt.create( "positivelycharged", "pc", MFnNumericData::kBoolean);
 	nAttrt.setStorable(true);
 	nAttrt.setKeyable(true);
@@ -141,18 +224,83 @@ MStatus finalproject::initialize()
 
 	MCheckStatus(status, "ERROR in attributeAffects\n");
  	
+ 	//the backend runs the exact kernels, every one gives the same result up to
+ 	//rounding. The values match BackendType, so scenes saved with the old
+ 	//boolean offload load as simd (off) or openmp (on)
+ 	MFnEnumAttribute eAttrO;
+ 	offload=eAttrO.create( "offload", "ol", BACKEND_SIMD);
+ 	eAttrO.addField("simd", BACKEND_SIMD);
+ 	eAttrO.addField("openmp", BACKEND_OPENMP);
+ 	eAttrO.addField("scalar", BACKEND_SCALAR);
+ 	eAttrO.addField("tbb", BACKEND_TBB);
+ 	eAttrO.setStorable(true);
+ 	eAttrO.setKeyable(true);
+	
  	MFnNumericAttribute nAttrO;
- 	offload=nAttrO.create( "offload", "ol", MFnNumericData::kBoolean);
- 	nAttrO.setStorable(true);
- 	nAttrO.setDefault(false);
- 	nAttrO.setKeyable(true);
+ 	singlePrecision=nAttrO.create( "singlePrecision", "sgl", MFnNumericData::kBoolean);
+	nAttrO.setStorable(true);
+	nAttrO.setDefault(false);
+	nAttrO.setKeyable(true);
+	
+	//translate moves the whole object by one vector, falloff moves every
+	//vertex by the field at its own position
+	MFnEnumAttribute eAttr;
+	deformMode=eAttr.create( "deformMode", "dfm", kTranslate);
+	eAttr.addField("translate", kTranslate);
+	eAttr.addField("falloff", kFalloff);
+	eAttr.setStorable(true);
+	eAttr.setKeyable(true);
+	
+	//record writes every evaluation into bakeFile under the frame of time,
+	//playback reads the frame back instead of evaluating it
+	MFnUnitAttribute uAttr;
+	time=uAttr.create( "time", "tm", MFnUnitAttribute::kTime, 0.0);
+	uAttr.setStorable(true);
+	
+	//interactive evaluates proxies of about proxyVertices vertices each while
+	//Maya runs interactively and is not rendering. Renders, from the GUI or
+	//batch, and bake recording always see the full meshes
+	MFnEnumAttribute eAttrL;
+	levelOfDetail=eAttrL.create( "levelOfDetail", "lod", kLodFull);
+	eAttrL.addField("full", kLodFull);
+	eAttrL.addField("interactive", kLodInteractive);
+	eAttrL.setStorable(true);
+	eAttrL.setKeyable(true);
+	
+	MFnNumericAttribute nAttrL;
+	proxyVertices=nAttrL.create( "proxyVertices", "pxv", MFnNumericData::kInt);
+	nAttrL.setStorable(true);
+	nAttrL.setKeyable(true);
+	nAttrL.setDefault(8);
+	nAttrL.setMin(2);
+	nAttrL.setSoftMax(64);
+	
+	MFnEnumAttribute eAttrB;
+	bakeMode=eAttrB.create( "bakeMode", "bkm", kBakeOff);
+	eAttrB.addField("off", kBakeOff);
+	eAttrB.addField("record", kBakeRecord);
+	eAttrB.addField("playback", kBakePlayback);
+	eAttrB.setStorable(true);
+	
+	MFnTypedAttribute tAttrB;
+	bakeFile=tAttrB.create( "bakeFile", "bkf", MFnData::kString);
+	tAttrB.setStorable(true);
 	
  	//  deformation attributes
- 	status = addAttribute( deformingMesh );
+ 	status = addAttribute( magnets );
 	MCheckStatus(status, "ERROR in addAttribute\n");
 
+ 	status = attributeAffects( magnets, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
  	status = attributeAffects( deformingMesh, outputGeom );
 	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+ 	status = attributeAffects( magnetStrength, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+ 	status = attributeAffects( magnetReversed, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
 	
    status = addAttribute( offload );
 	MCheckStatus(status, "ERROR in addAttribute\n");
@@ -160,178 +308,345 @@ MStatus finalproject::initialize()
  	status = attributeAffects( offload, outputGeom );
 	MCheckStatus(status, "ERROR in attributeAffects\n");
 
+   status = addAttribute( singlePrecision );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( singlePrecision, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( deformMode );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( deformMode, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( levelOfDetail );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( levelOfDetail, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( proxyVertices );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( proxyVertices, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( time );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( time, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( bakeMode );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( bakeMode, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
+   status = addAttribute( bakeFile );
+	MCheckStatus(status, "ERROR in addAttribute\n");
+
+ 	status = attributeAffects( bakeFile, outputGeom );
+	MCheckStatus(status, "ERROR in attributeAffects\n");
+
 	return MStatus::kSuccess;
 }
 
-MStatus finalproject::compute(const MPlug& plug, MDataBlock& data)
+MStatus finalproject::setDependentsDirty(const MPlug& plug, MPlugArray& plugArray)
 {
-	// do this if we are using an OpenMP implementation that is not the same as Maya's.
-	// Even if it is the same, it does no harm to make this call.
-	MThreadUtils::syncNumOpenMPThreads();
+	//can run on another thread while compute does
+	if (plug == deformingMesh || plug == magnets) {
+		pipeline.magnetChanged();
+	}
+	return MPxDeformerNode::setDependentsDirty(plug, plugArray);
+}
 
+MStatus finalproject::compute(const MPlug& plug, MDataBlock& data)
+{
 	MStatus status = MStatus::kUnknownParameter;
  	if (plug.attribute() != outputGeom) {
 		return status;
 	}
 
-	unsigned int index = plug.logicalIndex();
+	//every output is written by one evaluation, so a second request for
+	//another element waits for it instead of racing on the handles and the
+	//pipeline's caches
+	ScopedLock guard(pipeline.evaluationLock());
+
+	//per phase timings are only taken when the profile attribute is on. The
+	//data block reads below are timed into the fetch phase
+	PipelineSettings settings;
+	settings.profile = data.inputValue(profile, &status).asBool();
+	double fetchStart = settings.profile ? omp_get_wtime() : 0;
+
+	settings.backend = data.inputValue(offload, &status).asShort();
+	// do this if we are using an OpenMP implementation that is not the same as Maya's.
+	// Even if it is the same, it does no harm to make this call.
+	//with the TBB backend the pipeline runs its OpenMP loops on one thread
+	MThreadUtils::syncNumOpenMPThreads();
+
 	MObject thisNode = this->thisMObject();
 
-	// get input value
-	MPlug inPlug(thisNode,input);
-	inPlug.selectAncestorLogicalIndex(index,input);
-	MDataHandle hInput = data.inputValue(inPlug, &status);
-	MCheckStatus(status, "ERROR getting input mesh\n");
-	
-	// get the input geometry
-	MDataHandle inputData = hInput.child(inputGeom);
-	if (inputData.type() != MFnData::kMesh) {
- 		printf("Incorrect input geometry type\n");
-		return MStatus::kFailure;
- 	}
-
-	// get the input groupId - ignored for now...
-	MDataHandle hGroup = inputData.child(groupId);
-	unsigned int groupId = hGroup.asLong();
-
-	// get deforming mesh
-	MDataHandle deformData = data.inputValue(deformingMesh, &status);
-	MCheckStatus(status, "ERROR getting deforming mesh\n");
-    if (deformData.type() != MFnData::kMesh) {
-		printf("Incorrect deformer geometry type %d\n", deformData.type());
-		return MStatus::kFailure;
+	// get deforming meshes, elements without a mesh connected are skipped
+	MArrayDataHandle magnetArray = data.inputArrayValue(magnets, &status);
+	MCheckStatus(status, "ERROR getting magnets\n");
+	unsigned int numElements = magnetArray.elementCount();
+	magSurfaces.resize(numElements);
+	magStrengths.resize(numElements);
+	numMagnetInputs = 0;
+	for (unsigned int k = 0; k < numElements; k++) {
+		magnetArray.jumpToArrayElement(k);
+		MDataHandle element = magnetArray.inputValue(&status);
+		MCheckStatus(status, "ERROR getting magnet\n");
+		MDataHandle deformData = element.child(deformingMesh);
+		if (deformData.type() != MFnData::kMesh) {
+			continue;
+		}
+		//the magnet's strength and direction are folded into its polarity
+		magSurfaces[numMagnetInputs] = deformData.asMeshTransformed();
+		magStrengths[numMagnetInputs] = element.child(magnetStrength).asDouble() 
+			* (element.child(magnetReversed).asBool() ? -1 : 1);
+		numMagnetInputs++;
 	}
 	
-   MDataHandle offloadData = data.inputValue(offload, &status);
-
-   //gathers world space positions of the object and the magnet
-  	MObject dSurf = deformData.asMeshTransformed();
-  	MObject iSurf = inputData.asMeshTransformed();
- 	MFnMesh fnDeformingMesh, fnInputMesh;
- 	fnDeformingMesh.setObject( dSurf ) ;
- 	fnInputMesh.setObject( iSurf ) ;
-
-	MDataHandle outputData = data.outputValue(plug);
-	outputData.copy(inputData);
- 	if (outputData.type() != MFnData::kMesh) {
-		printf("Incorrect output mesh type\n");
-		return MStatus::kFailure;
-	}
-	
-	MItGeometry iter(outputData, groupId, false);
-
-	// get all points at once. Faster to query, and also better for
-	// threading than using iterator
-	MPointArray objVerts;
-	iter.allPositions(objVerts);
-	int objNumPoints = objVerts.length();
- 	
- 	MPointArray magVerts, tempverts;
- 	fnDeformingMesh.getPoints(magVerts);
- 	fnInputMesh.getPoints(tempverts);
- 	int magNumPoints = magVerts.length();
- 	
- 	double min = DBL_MAX, max = -DBL_MAX;
-   
-   //finds min and max z-coordinate values to determine middle point (choice of z-axis was ours)
- 	for (int i = 0; i < magNumPoints; i++) {
-      min = magVerts[i].z < min ? magVerts[i].z : min;
-      max = magVerts[i].z > max ? magVerts[i].z : max;
+   settings.singlePrecision = data.inputValue(singlePrecision, &status).asBool();
+ 	settings.tesla = data.inputValue(tesla, &status).asDouble();
+   settings.positive = data.inputValue(positivelycharged, &status).asBool();
+   settings.openingAngle = data.inputValue(openingAngle, &status).asDouble();
+   settings.influenceRadius = data.inputValue(influenceRadius, &status).asDouble();
+   //the cutoff sums always run in double with the widest instruction set, the
+   //warning comes again once the combination was left and is picked again
+   bool overridden = settings.influenceRadius > 0 
+      && (settings.singlePrecision || settings.backend != BACKEND_SIMD);
+   if (overridden && !cutoffWarned) {
+      MGlobal::displayWarning("finalproject: influenceRadius above 0 ignores offload and singlePrecision");
    }
-
-   double middle = (min + max) / 2;
-   double polarity[magNumPoints];
-   
-   //assigns polarity based on middle point of mesh
-   for (int i = 0; i < magNumPoints; i++) {
-      polarity[i] = magVerts[i].z > middle ? max / magVerts[i].z : -min / magVerts[i].z;
+   cutoffWarned = overridden;
+   settings.maxSubsteps = data.inputValue(maxSubsteps, &status).asInt();
+   settings.falloff = data.inputValue(deformMode, &status).asShort() == kFalloff;
+   //a render from the interactive session still sees the full meshes
+   if (data.inputValue(levelOfDetail, &status).asShort() == kLodInteractive
+      && MGlobal::mayaState() == MGlobal::kInteractive
+      && MRenderUtil::mayaRenderState() == MRenderUtil::kNotRendering) {
+      settings.proxyVertices = data.inputValue(proxyVertices, &status).asInt();
    }
- 	
- 	double* objdVerts = (double *)malloc(sizeof(double) * objNumPoints * 3);
- 	double* magdVerts = (double *)malloc(sizeof(double) * magNumPoints * 3);
- 	
-   //creates handles to use attribute data
- 	MDataHandle vecX = data.inputValue(transX, &status);
-   MDataHandle vecY = data.inputValue(transY, &status);
-   MDataHandle vecZ = data.inputValue(transZ, &status);
+   settings.bakeMode = data.inputValue(bakeMode, &status).asShort();
+   MString bakePath = data.inputValue(bakeFile, &status).asString();
+   settings.bakeFile = bakePath.asChar();
+   settings.frame = (int)floor(data.inputValue(time, &status).asTime().as(MTime::uiUnit()) + 0.5);
    
-   //gathers previously stored coordinates of the center of the object
-   double moveX = vecX.asFloat();
-   double moveY = vecY.asFloat();
-   double moveZ = vecZ.asFloat();
- 	
-   //translates object based on the position stored in the attribute values
- 	for (int i=0; i<objNumPoints; i++) {
- 	   objdVerts[i * 3] = tempverts[i].x + moveX;
- 	   objdVerts[i * 3 + 1] = tempverts[i].y + moveY;
- 	   objdVerts[i * 3 + 2] = tempverts[i].z + moveZ;
- 	}
- 	
- 	for (int i=0; i<magNumPoints; i++) {
- 	   magdVerts[i * 3] = magVerts[i].x;
- 	   magdVerts[i * 3 + 1] = magVerts[i].y;
- 	   magdVerts[i * 3 + 2] = magVerts[i].z;
- 	}
- 	
- 	double teslaData = data.inputValue(tesla, &status).asDouble();
-   MDataHandle posiData = data.inputValue(positivelycharged, &status);
-   
-   double pivot[6] = {DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX};
-   
-   //finds the pivot point of the object in world space prior to being affected by the magnet
- 	for (int i = 0; i < tempverts.length(); i++) {
-      pivot[0] = tempverts[i].x < pivot[0] ? tempverts[i].x : pivot[0];
-      pivot[1] = tempverts[i].x > pivot[1] ? tempverts[i].x : pivot[1];
-      pivot[2] = tempverts[i].y < pivot[2] ? tempverts[i].y : pivot[2];
-      pivot[3] = tempverts[i].y > pivot[3] ? tempverts[i].y : pivot[3];
-      pivot[4] = tempverts[i].z < pivot[4] ? tempverts[i].z : pivot[4];
-      pivot[5] = tempverts[i].z > pivot[5] ? tempverts[i].z : pivot[5];
-   }
-   
-   MTimer timer; timer.beginTimer();
- 	
-   //main function call
-   magnetForce(magNumPoints, objNumPoints, teslaData, magdVerts, 
-      objdVerts, polarity, posiData.asBool(), offloadData.asBool());
-      
-   timer.endTimer(); printf("Runtime for threaded loop %f\n", timer.elapsedTime());
- 	
- 	for (int i=0; i<objNumPoints; i++) {
- 	   objVerts[i].x = objdVerts[i * 3 + 0];
- 	   objVerts[i].y = objdVerts[i * 3 + 1];
- 	   objVerts[i].z = objdVerts[i * 3 + 2];      
- 	}
- 	
-   //finds the pivot point of object in world space after being affected by the magnet
-   double objCenter[6] = {DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX};
- 	for (int i = 0; i < tempverts.length(); i++) {
-      objCenter[0] = objVerts[i].x < objCenter[0] ? objVerts[i].x : objCenter[0];
-      objCenter[1] = objVerts[i].x > objCenter[1] ? objVerts[i].x : objCenter[1];
-      objCenter[2] = objVerts[i].y < objCenter[2] ? objVerts[i].y : objCenter[2];
-      objCenter[3] = objVerts[i].y > objCenter[3] ? objVerts[i].y : objCenter[3];
-      objCenter[4] = objVerts[i].z < objCenter[4] ? objVerts[i].z : objCenter[4];
-      objCenter[5] = objVerts[i].z > objCenter[5] ? objVerts[i].z : objCenter[5];
-   }
- 	
-   //creates vector based on the two calculated pivot points
- 	moveX = (objCenter[0] + objCenter[1]) / 2 - (pivot[0] + pivot[1]) / 2;
- 	moveY = (objCenter[2] + objCenter[3]) / 2 - (pivot[2] + pivot[3]) / 2;
- 	moveZ = (objCenter[4] + objCenter[5]) / 2 - (pivot[4] + pivot[5]) / 2;
- 	
-   //stores pivot vector for next computation
- 	if (teslaData) {
- 	   vecX.setFloat(moveX);
- 	   vecY.setFloat(moveY);
- 	   vecZ.setFloat(moveZ);
- 	}
- 	
+   //transX/Y/Z only seed the stored translation of the geometry at logical
+   //index 0, the translation itself is kept in storedTranslation and
+   //compute never writes back into its inputs
+   settings.seed[0] = data.inputValue(transX, &status).asDouble();
+   settings.seed[1] = data.inputValue(transY, &status).asDouble();
+   settings.seed[2] = data.inputValue(transZ, &status).asDouble();
+
+	//every connected input geometry is evaluated in the same batch, whichever
+	//outputGeom element was asked for
+	MArrayDataHandle inputArray = data.inputArrayValue(input, &status);
+	MCheckStatus(status, "ERROR getting input meshes\n");
+	MArrayDataHandle moveArray = data.outputArrayValue(storedTranslation, &status);
+	MCheckStatus(status, "ERROR getting stored translations\n");
+	unsigned int numInputs = inputArray.elementCount();
+	geometries.resize(numInputs);
+	numGeometryInputs = 0;
+	for (unsigned int g = 0; g < numInputs; g++) {
+		inputArray.jumpToArrayElement(g);
+		MDataHandle hInput = inputArray.inputValue(&status);
+		MCheckStatus(status, "ERROR getting input mesh\n");
+		Geometry& geometry = geometries[numGeometryInputs];
+		geometry.index = inputArray.elementIndex();
+		
+		// get the input geometry
+		//elements that hold no mesh are left alone
+		MDataHandle inputData = hInput.child(inputGeom);
+		if (inputData.type() != MFnData::kMesh) {
+			continue;
+	 	}
+
+		// get the input groupId - ignored for now...
+		geometry.groupId = hInput.child(groupId).asLong();
+
+		//the output starts as a copy of the input, outputs the pipeline does
+		//not write keep it
+		MPlug outPlug(thisNode, outputGeom);
+		outPlug.selectAncestorLogicalIndex(geometry.index, outputGeom);
+		geometry.output = data.outputValue(outPlug);
+		geometry.output.copy(inputData);
+	 	if (geometry.output.type() != MFnData::kMesh) {
+			continue;
+		}
+
+	   //gathers world space positions of the object
+		geometry.surface = inputData.asMeshTransformed();
+		
+		//the stored translation of the geometry, read by the pipeline the first
+		//time it sees the geometry and written by every evaluation
+		geometry.stored = moveArray.jumpToElement(geometry.index) == MStatus::kSuccess;
+		MPlug movePlug(thisNode, storedTranslation);
+		movePlug.selectAncestorLogicalIndex(geometry.index, storedTranslation);
+		geometry.move = data.outputValue(movePlug);
+		numGeometryInputs++;
+	}
+
+	//the points, the kernel, the outputs and the bake, see magnetpipeline.h
+	if (settings.profile) {
+		settings.fetchSeconds = omp_get_wtime() - fetchStart;
+	}
+	pipeline.evaluate(*this, settings);
+
+	setOutputsClean(plug, data);
+	return MStatus::kSuccess;
+}
+
+//reads the points straight out of the mesh's float storage
+const float* finalproject::magnetPoints(int k, int* numPoints)
+{
+	MStatus status;
+	fnMesh.setObject( magSurfaces[k] );
+	*numPoints = fnMesh.numVertices();
+	const float* raw = fnMesh.getRawPoints(&status);
+	if (status != MStatus::kSuccess) {
+		cerr << "ERROR reading deforming mesh points\n";
+		return NULL;
+	}
+	return raw;
+}
+
+const float* finalproject::geometryPoints(int g, int* numPoints)
+{
+	MStatus status;
+	fnMesh.setObject( geometries[g].surface );
+	*numPoints = fnMesh.numVertices();
+	const float* raw = fnMesh.getRawPoints(&status);
+	if (status != MStatus::kSuccess) {
+		cerr << "ERROR reading input mesh points\n";
+		return NULL;
+	}
+	return raw;
+}
+
+void finalproject::writePoints(int g, const double* x, const double* y, const double* z, int numPoints)
+{
+	//one output array serves every geometry, so setLength only allocates
+	//when a geometry is larger than all before it
+	outVerts.setLength(numPoints);
+	#pragma omp parallel for
+	for (int i = 0; i < numPoints; i++) {
+		MPoint& p = outVerts[i];
+		p.x = x[i];
+		p.y = y[i];
+		p.z = z[i];
+	}
+
 	// write values back onto output using fast set method on iterator
-	iter.setAllPositions(objVerts, MSpace::kWorld);
-   
-   free(objdVerts);
-   free(magdVerts);
+	MItGeometry iter(geometries[g].output, geometries[g].groupId, false);
+	iter.setAllPositions(outVerts, MSpace::kWorld);
+}
 
-	return status;
+bool finalproject::storedMove(int g, double move[3])
+{
+	if (!geometries[g].stored) {
+		return false;
+	}
+	double3& value = geometries[g].move.asDouble3();
+	move[0] = value[0];
+	move[1] = value[1];
+	move[2] = value[2];
+	return true;
+}
+
+void finalproject::writeMove(int g, const double move[3])
+{
+	geometries[g].move.set(move[0], move[1], move[2]);
+}
+
+void finalproject::setOutputsClean(const MPlug& plug, MDataBlock& data)
+{
+	MObject thisNode = this->thisMObject();
+	for (int g = 0; g < numGeometryInputs; g++) {
+		MPlug outPlug(thisNode, outputGeom);
+		outPlug.selectAncestorLogicalIndex(geometries[g].index, outputGeom);
+		data.setClean(outPlug);
+		MPlug movePlug(thisNode, storedTranslation);
+		movePlug.selectAncestorLogicalIndex(geometries[g].index, storedTranslation);
+		data.setClean(movePlug);
+	}
+	data.setClean(plug);
+}
+
+//
+//  magnetProfile [-clear] nodeName
+//
+//  Returns the samples recorded by a finalproject node with profile turned on,
+//  oldest first, one string per evaluation (times in milliseconds). The first
+//  string is a header naming the columns. -clear empties the log instead.
+//
+class magnetProfile : public MPxCommand
+{
+public:
+	static void* creator() { return new magnetProfile(); }
+	virtual MStatus doIt(const MArgList& args);
+};
+
+MStatus magnetProfile::doIt(const MArgList& args)
+{
+	bool clear = false;
+	MString nodeName;
+	for (unsigned int a = 0; a < args.length(); a++) {
+		MString arg = args.asString(a);
+		if (arg == "-clear" || arg == "-c") {
+			clear = true;
+		} else {
+			nodeName = arg;
+		}
+	}
+
+	MSelectionList list;
+	MObject node;
+	if (!list.add(nodeName) || !list.getDependNode(0, node)) {
+		displayError("magnetProfile: no node named " + nodeName);
+		return MStatus::kInvalidParameter;
+	}
+	MFnDependencyNode fnNode(node);
+	if (fnNode.typeId() != finalproject::id) {
+		displayError("magnetProfile: " + nodeName + " is not a finalproject node");
+		return MStatus::kInvalidParameter;
+	}
+	ProfileLog& log = ((finalproject*)fnNode.userNode())->profileLog();
+
+	if (clear) {
+		log.clear();
+		return MStatus::kSuccess;
+	}
+
+	std::vector<ProfileSample> samples(ProfileLog::CAPACITY);
+	int count = log.snapshot(&samples[0]);
+
+	char line[512];
+	int len = sprintf(line, "evaluation objVerts magVerts threads");
+	for (int p = 0; p < NUM_PHASES; p++) {
+		len += sprintf(line + len, " %s", ProfileLog::phaseName(p));
+	}
+	sprintf(line + len, " total");
+
+	MStringArray result;
+	result.append(line);
+	for (int k = 0; k < count; k++) {
+		const ProfileSample& sample = samples[k];
+		double total = 0;
+		len = sprintf(line, "%lu %d %d %d", sample.evaluation, sample.numObj, sample.numMag, sample.threads);
+		for (int p = 0; p < NUM_PHASES; p++) {
+			len += sprintf(line + len, " %.3f", sample.seconds[p] * 1000.0);
+			total += sample.seconds[p];
+		}
+		sprintf(line + len, " %.3f", total * 1000.0);
+		result.append(line);
+	}
+	setResult(result);
+	return MStatus::kSuccess;
 }
 
 // standard initialization procedures
@@ -342,6 +657,9 @@ MStatus initializePlugin( MObject obj )
 	MFnPlugin plugin( obj, PLUGIN_COMPANY, "1.0", "Any");
 	result = plugin.registerNode( "finalproject", finalproject::id, finalproject::creator, 
 								  finalproject::initialize, MPxNode::kDeformerNode );
+	MCheckStatus(result, "ERROR registering finalproject node\n");
+
+	result = plugin.registerCommand( "magnetProfile", magnetProfile::creator );
 
 	return result;
 }
@@ -350,6 +668,9 @@ MStatus uninitializePlugin( MObject obj)
 {
 	MStatus result;
 	MFnPlugin plugin( obj );
+	result = plugin.deregisterCommand( "magnetProfile" );
+	MCheckStatus(result, "ERROR deregistering magnetProfile command\n");
+
 	result = plugin.deregisterNode( finalproject::id );
 	return result;
 }
@@ -1,83 +1,127 @@
-#include <algorithm>
-#include <cassert>
-#include <cmath>
-#include <cstdio>
-#include <chrono>
-#include "omp.h"
-#include <limits.h>
-#include "math.h"
-
-__attribute__((noinline))
-void magnetForce(
-  const int numMag,
-  const int numObj,
-  const double tesla,
-  double const* mag, 
-  double* obj,
-  const double* polarityValues,     //1 if positive, -1 if negative
-  const int objectPolarity,         //1 if positive, 0 if negative
-  bool offloadFlag
-) 
-{  
-   double closest = INT_MAX;
-   double sum = 0;
-   int closObj;
-   int closMag;
-   double vec[3];
-   
-   //offloads all the input arrays and needed variables with the conditional boolean attribute
-   #pragma offload target(mic:1) if(offloadFlag) in(numMag) in(numObj) in(tesla) \
-      in(mag:length(numMag*3)) in(obj:length(numObj*3)) in(polarityValues:length(numMag)) \
-      in(objectPolarity) in(closest) inout(sum) inout(closObj) inout(closMag) inout(vec)
-   {  
-   #pragma omp parallel for reduction (+: sum) 
-   for (int i=0; i < numMag; i++) {
-      //determines if value added to sum represents attraction or repulsion
-      double magFactor = objectPolarity ? polarityValues[i] : -polarityValues[i];
-      for (int j=0; j < numObj; j++) {
-         
-         double dist = sqrt(pow(mag[i*3+0] - obj[j*3+0],2) + pow(mag[i*3+1] - obj[j*3+1],2) 
-            + pow(mag[i*3+2] - obj[j*3+2],2));
-            
-         #pragma omp critical 
-         {
-            //determines the closest points between the magnet and the object
-            if (dist < closest) {
-               closest = dist;
-               closMag = i;
-               closObj = j;
-            }
-         }
-         //value of magnetic influence exponentially decreases with distance,
-         sum += tesla / (magFactor * pow(dist, 2));
-      }
-   }
-   }
-   
-   //compute average magnetic influence per vertex
-   double avg = sum * (1.0 / numObj);
-   
-   //vector between the two closest points
-   vec[0] = obj[closObj*3+0] - mag[closMag*3+0];
-   vec[1] = obj[closObj*3+1] - mag[closMag*3+1];
-   vec[2] = obj[closObj*3+2] - mag[closMag*3+2];
-   
-   double norm = sqrt(pow(vec[0],2) + pow(vec[1],2) + pow(vec[2],2));
-   
-   //object can only be attracted or repelled a distance less than or equal
-   //to the components of the closest points vector
-   vec[0] = fabs((vec[0] / norm) * avg) >= fabs(vec[0]) ? vec[0] : (vec[0] / norm) * avg;
-   vec[1] = fabs((vec[1] / norm) * avg) >= fabs(vec[1]) ? vec[1] : (vec[1] / norm) * avg;
-   vec[2] = fabs((vec[2] / norm) * avg) >= fabs(vec[2]) ? vec[2] : (vec[2] / norm) * avg;
-   
-   //updates positions of vertices
-   if (tesla != 0) {
-      #pragma simd
-      for (int j = 0; j < numObj; j++) {
-         obj[j*3+1] = obj[j*3+1] + vec[1];
-         obj[j*3+2] = obj[j*3+2] + vec[2];
-         obj[j*3+0] = obj[j*3+0] + vec[0];                  
-      }
-   }
-}   
+//
+//  File: finalproject.h
+//
+//  Authors: Eric Dazet and Arnav Muruildhar
+//
+//  Description:
+//    Magnet deformer node. The physics lives in magnetcore.h and the rest of
+//    the evaluation in magnetpipeline.h, so that both can be built and run
+//    without Maya. The node only feeds the pipeline from its data block.
+//
 
+#ifndef FINALPROJECT_H
+#define FINALPROJECT_H
+
+#include <maya/MPxDeformerNode.h> 
+#include <maya/MTypeId.h>
+#include <maya/MPlugArray.h>
+#include <maya/MPointArray.h>
+#include <maya/MFnMesh.h>
+
+#include <vector>
+
+#include "magnetpipeline.h"
+
+class finalproject : public MPxDeformerNode, public MagnetHost
+{
+public:
+						finalproject();
+	virtual				~finalproject();
+
+	static  void*		creator();
+	static  MStatus		initialize();
+
+	// deformation function
+	//
+	virtual MStatus compute(const MPlug& plug, MDataBlock& dataBlock);
+
+	// flags the magnet points for rehashing when the magnet changes
+	//
+	virtual MStatus setDependentsDirty(const MPlug& plug, MPlugArray& plugArray);
+
+public:
+	// local node attributes
+
+	static  MTypeId		id;
+
+	static MObject magnets;         //array of magnets, each with the three children below
+	static MObject deformingMesh;   //mesh of one magnet
+	static MObject magnetStrength;  //multiplies the influence of one magnet
+	static MObject magnetReversed;  //swaps the polarity of one magnet
+	static MObject transX; //attribute to seed the x-value of the stored translation of the object
+	static MObject transY; //attribute to seed the y-value of the stored translation of the object
+	static MObject transZ; //attribute to seed the z-value of the stored translation of the object
+	                       //(geometry 0 only, a new value restarts it, compute never writes them)
+	static MObject storedTranslation; //output array of the stored translation of every geometry, indexed like outputGeom
+	static MObject offload; //attribute to pick the compute backend of the exact kernels, see BackendType
+	static MObject singlePrecision;  //attribute to evaluate the influence sum in float instead of double
+	static MObject tesla;   //attribute representing magnetic strength value
+	static MObject openingAngle;  //attribute for the Barnes-Hut accuracy, 0 computes every pair
+	static MObject influenceRadius;  //attribute to skip magnet vertices further away than this, 0 keeps every pair
+	static MObject maxSubsteps;  //attribute for the most sub-steps an object close to the magnet takes, 1 is off
+	static MObject levelOfDetail;  //attribute to evaluate proxies instead of the full meshes while interactive
+	static MObject proxyVertices;  //attribute for the vertices one proxy stands for, see proxycloud.h
+	static MObject positivelycharged;  //attribute representing polarity of the object
+	static MObject profile;  //attribute to record per phase timings, see magnetProfile
+	static MObject deformMode;  //attribute to pick the rigid translation or the per vertex falloff
+	static MObject time;        //attribute holding the current time, the frame a bake records or plays back
+	static MObject bakeMode;    //attribute to record every evaluation into bakeFile or play it back
+	static MObject bakeFile;    //attribute naming the bake cache file, see bakecache.h
+
+	//values of deformMode
+	enum DeformMode { kTranslate = 0, kFalloff = 1 };
+
+	//values of levelOfDetail
+	enum LevelOfDetail { kLodFull = 0, kLodInteractive = 1 };
+
+	//values of bakeMode, the same as PipelineBake
+	enum BakeMode { kBakeOff = 0, kBakeRecord = 1, kBakePlayback = 2 };
+
+	//timings of the most recent profiled evaluations
+	ProfileLog& profileLog() { return pipeline.profileLog; }
+
+	// MagnetHost, what the pipeline reads from and writes to the data block
+	//
+	virtual int numMagnets() { return numMagnetInputs; }
+	virtual const float* magnetPoints(int k, int* numPoints);
+	virtual double signedStrength(int k) { return magStrengths[k]; }
+	virtual int numGeometries() { return numGeometryInputs; }
+	virtual unsigned int geometryIndex(int g) { return geometries[g].index; }
+	virtual const float* geometryPoints(int g, int* numPoints);
+	virtual void writePoints(int g, const double* x, const double* y, const double* z, int numPoints);
+	virtual bool storedMove(int g, double move[3]);
+	virtual void writeMove(int g, const double move[3]);
+
+private:
+	void setOutputsClean(const MPlug& plug, MDataBlock& data);
+
+	//one connected input geometry during an evaluation
+	struct Geometry
+	{
+		unsigned int index;       //logical index in input and outputGeom
+		unsigned int groupId;
+		MObject surface;          //world space input mesh
+		MDataHandle output;
+		MDataHandle move;         //storedTranslation element
+		bool stored;              //the element was there before this evaluation
+	};
+
+	//compute and setDependentsDirty may run on other threads than the ones
+	//that created the node. The handles below belong to one evaluation and
+	//are only touched by compute while it holds the pipeline's
+	//evaluationLock, which covers the evaluation itself as well
+	MagnetPipeline pipeline;  //everything kept between evaluations
+
+	//inputs of the current evaluation, kept so their storage is reused
+	std::vector<MObject> magSurfaces;
+	std::vector<double> magStrengths;  //signed strength of every magnet
+	int numMagnetInputs;
+	std::vector<Geometry> geometries;
+	int numGeometryInputs;
+	bool cutoffWarned;       //influenceRadius overrides offload or singlePrecision, warned about once
+
+	MFnMesh fnMesh;          //reads the points of every mesh
+	MPointArray outVerts;    //output positions, setLength only allocates when a geometry is larger
+};
+
+#endif
@@ -0,0 +1,147 @@
+//
+//  File: kdtree.h
+//
+//  Description:
+//    Balanced k-d tree over a set of 3D points, used to find the closest
+//    magnet vertex to an object vertex in O(log n) instead of O(n).
+//
+
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+class KdTree
+{
+public:
+   KdTree() : count(0) {}
+
+   //builds the tree from numPoints planar points (all x, then all y, then all z),
+   //the input is copied
+   void build(const double* points, int numPoints)
+   {
+      count = numPoints;
+      pts.resize(count * 3);
+      idx.resize(count);
+      axis.assign(count, 0);
+      for (int i = 0; i < count; i++) {
+         idx[i] = i;
+      }
+      //orders idx so every node splits its range at the median
+      split(points, 0, count);
+      for (int k = 0; k < count; k++) {
+         pts[k * 3 + 0] = points[idx[k]];
+         pts[k * 3 + 1] = points[count + idx[k]];
+         pts[k * 3 + 2] = points[2 * count + idx[k]];
+      }
+   }
+
+   int size() const { return count; }
+
+   //returns the index of the point closest to q and its squared distance,
+   //ties go to the lowest index so the answer matches a linear scan
+   int nearest(const double* q, double* distSq) const
+   {
+      int best = -1;
+      double bestDist = DBL_MAX;
+      if (count > 0) {
+         search(q, 0, count, best, bestDist);
+      }
+      *distSq = bestDist;
+      return best;
+   }
+
+private:
+   //ranges at or below this size are scanned linearly
+   enum { LEAF_SIZE = 8 };
+
+   struct AxisLess
+   {
+      const double* coords;   //the planar block of the split axis
+      bool operator()(int l, int r) const
+      {
+         double pl = coords[l], pr = coords[r];
+         return pl < pr || (pl == pr && l < r);
+      }
+   };
+
+   void split(const double* points, int lo, int hi)
+   {
+      if (hi - lo <= LEAF_SIZE) {
+         return;
+      }
+
+      //splits along the axis with the largest extent
+      double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+      double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+      for (int k = lo; k < hi; k++) {
+         for (int a = 0; a < 3; a++) {
+            double v = points[a * count + idx[k]];
+            min[a] = v < min[a] ? v : min[a];
+            max[a] = v > max[a] ? v : max[a];
+         }
+      }
+      int a = 0;
+      for (int b = 1; b < 3; b++) {
+         a = max[b] - min[b] > max[a] - min[a] ? b : a;
+      }
+
+      int mid = (lo + hi) / 2;
+      AxisLess less = {points + a * count};
+      std::nth_element(idx.begin() + lo, idx.begin() + mid, idx.begin() + hi, less);
+      axis[mid] = a;
+
+      split(points, lo, mid);
+      split(points, mid + 1, hi);
+   }
+
+   void visit(const double* q, int k, int& best, double& bestDist) const
+   {
+      double dx = pts[k * 3 + 0] - q[0];
+      double dy = pts[k * 3 + 1] - q[1];
+      double dz = pts[k * 3 + 2] - q[2];
+      double d = dx * dx + dy * dy + dz * dz;
+      if (d < bestDist || (d == bestDist && idx[k] < best)) {
+         bestDist = d;
+         best = idx[k];
+      }
+   }
+
+   void search(const double* q, int lo, int hi, int& best, double& bestDist) const
+   {
+      if (hi - lo <= LEAF_SIZE) {
+         for (int k = lo; k < hi; k++) {
+            visit(q, k, best, bestDist);
+         }
+         return;
+      }
+
+      int mid = (lo + hi) / 2;
+      int a = axis[mid];
+      visit(q, mid, best, bestDist);
+
+      //descends into the half containing q first, the other half is only
+      //visited if it can hold a point at least as close (<= keeps tie-breaks exact)
+      double diff = q[a] - pts[mid * 3 + a];
+      if (diff < 0) {
+         search(q, lo, mid, best, bestDist);
+         if (diff * diff <= bestDist) {
+            search(q, mid + 1, hi, best, bestDist);
+         }
+      } else {
+         search(q, mid + 1, hi, best, bestDist);
+         if (diff * diff <= bestDist) {
+            search(q, lo, mid, best, bestDist);
+         }
+      }
+   }
+
+   int count;
+   std::vector<double> pts;   //points in tree order
+   std::vector<int> idx;      //original index of each point in tree order
+   std::vector<int> axis;     //split axis of the node stored at each position
+};
+
+#endif
@@ -0,0 +1,119 @@
+//
+//  File: magnet.cpp
+//
+//  Description:
+//    Command line driver for the magnet kernel. Loads a magnet and an object
+//    point cloud, runs the same step finalproject::compute runs and writes
+//    the moved object, without needing Maya.
+//
+//    magnet [options] magnet.obj object.obj output.obj
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "magnetcache.h"
+#include "pointcloud.h"
+
+static void usage(const char* name)
+{
+   printf("usage: %s [options] magnet.(obj|ply) object.(obj|ply) output.(obj|ply)\n", name);
+   printf("  -tesla <value>    magnetic strength, default 1\n");
+   printf("  -negative         the object is negatively charged\n");
+   printf("  -angle <value>    Barnes-Hut opening angle, 0 sums every pair (default)\n");
+   printf("  -radius <value>   influence radius, pairs further apart are skipped, 0 is off (default)\n");
+   printf("  -single           evaluates the influence sum in single precision\n");
+   printf("  -falloff          moves every vertex by its own field instead of one translation\n");
+   printf("  -backend <name>   simd (default), openmp, scalar or tbb\n");
+   printf("  -substeps <n>     most sub-steps of an object close to the magnet, default 1\n");
+   printf("  -steps <n>        number of consecutive evaluations, default 1\n");
+   printf("  -threads <n>      number of OpenMP threads\n");
+}
+
+int main(int argc, char** argv)
+{
+   double tesla = 1.0, angle = 0.0, radius = 0.0;
+   bool positive = true, single = false, falloff = false;
+   int steps = 1, substeps = 1, backend = BACKEND_SIMD;
+   const char* paths[3];
+   int numPaths = 0;
+
+   for (int a = 1; a < argc; a++) {
+      if (!strcmp(argv[a], "-tesla") && a + 1 < argc) {
+         tesla = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-angle") && a + 1 < argc) {
+         angle = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-radius") && a + 1 < argc) {
+         radius = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-backend") && a + 1 < argc) {
+         a++;
+         for (backend = 0; backend < NUM_BACKENDS && strcmp(argv[a], backendName(backend)); backend++) {
+         }
+         if (!computeBackend(backend)) {
+            printf("Backend %s is not available\n", argv[a]);
+            return 1;
+         }
+      } else if (!strcmp(argv[a], "-substeps") && a + 1 < argc) {
+         substeps = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-steps") && a + 1 < argc) {
+         steps = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-threads") && a + 1 < argc) {
+         omp_set_num_threads(atoi(argv[++a]));
+      } else if (!strcmp(argv[a], "-negative")) {
+         positive = false;
+      } else if (!strcmp(argv[a], "-single")) {
+         single = true;
+      } else if (!strcmp(argv[a], "-falloff")) {
+         falloff = true;
+      } else if (argv[a][0] != '-' && numPaths < 3) {
+         paths[numPaths++] = argv[a];
+      } else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (numPaths != 3 || steps < 1 || substeps < 1) {
+      usage(argv[0]);
+      return 1;
+   }
+   if (radius > 0 && (single || backend != BACKEND_SIMD)) {
+      printf("-radius runs the cutoff sums in double with the widest instruction set, -single and -backend are ignored\n");
+   }
+
+   std::vector<double> mag, obj;
+   int numMag, numObj;
+   if (!readPointCloud(paths[0], mag, &numMag) || !readPointCloud(paths[1], obj, &numObj)) {
+      return 1;
+   }
+   if (numMag == 0 || numObj == 0) {
+      printf("Both point clouds need at least one vertex\n");
+      return 1;
+   }
+
+   //magnet data is prepared once, like the caches on the deformer node
+   double start = omp_get_wtime();
+   MagnetCache magnet;
+   magnet.update(&mag[0], numMag, hashValues(&mag[0], sizeof(double) * numMag * 3, numMag));
+   if (angle > 0) {
+      magnet.buildOctree();
+   }
+   magnet.buildGrid(radius);
+   printf("magnet %d vertices, object %d vertices, prepared in %f seconds\n", numMag, numObj,
+      omp_get_wtime() - start);
+
+   ScratchArena scratch;
+   for (int s = 0; s < steps; s++) {
+      start = omp_get_wtime();
+      scratch.reset();
+      if (falloff) {
+         magnet.field(numObj, tesla, angle, &obj[0], positive, single, backend, &scratch);
+      } else {
+         magnet.force(numObj, tesla, angle, &obj[0], positive, single, backend, &scratch, substeps);
+      }
+      printf("step %d: %f seconds\n", s + 1, omp_get_wtime() - start);
+   }
+
+   return writePointCloud(paths[2], &obj[0], numObj, paths[1]) ? 0 : 1;
+}
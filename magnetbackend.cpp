@@ -0,0 +1,313 @@
+//
+//  File: magnetbackend.cpp
+//
+//  Description:
+//    The compute backends, see magnetbackend.h.
+//
+
+#include <cmath>
+#include <vector>
+
+#include "magnetcore.h"
+
+#ifdef MAGNET_HAVE_TBB
+#include <algorithm>
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#endif
+
+//OpenMP loops of magnetcore.cpp with the rows compiled for one instruction set
+class OpenMPBackend : public ComputeBackend
+{
+public:
+   OpenMPBackend(const char* backendName, int simdLevel) : backendName(backendName), simdLevel(simdLevel) {}
+
+   const char* name() const { return backendName; }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, double const* mag,
+      double const* obj, const double* polarityValues, double* sums) const
+   {
+      ::inverseSquareSums(numMag, numObjects, objStart, mag, obj, polarityValues, simdLevel, sums);
+   }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, float const* mag,
+      float const* obj, const double* polarityValues, double* sums) const
+   {
+      ::inverseSquareSums(numMag, numObjects, objStart, mag, obj, polarityValues, simdLevel, sums);
+   }
+
+   void inverseSquareField(int numMag, int numObj, double const* mag, double const* obj,
+      double const* weights, double* field) const
+   {
+      ::inverseSquareField(numMag, numObj, mag, obj, weights, simdLevel, field);
+   }
+
+   void inverseSquareField(int numMag, int numObj, float const* mag, float const* obj,
+      float const* weights, double* field) const
+   {
+      ::inverseSquareField(numMag, numObj, mag, obj, weights, simdLevel, field);
+   }
+
+private:
+   const char* backendName;
+   int simdLevel;
+};
+
+//one thread and one pair at a time, the result every other backend is checked against
+class ScalarBackend : public ComputeBackend
+{
+public:
+   const char* name() const { return "scalar"; }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, double const* mag,
+      double const* obj, const double* polarityValues, double* sums) const
+   {
+      sumsOf(numMag, numObjects, objStart, mag, obj, polarityValues, sums);
+   }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, float const* mag,
+      float const* obj, const double* polarityValues, double* sums) const
+   {
+      sumsOf(numMag, numObjects, objStart, mag, obj, polarityValues, sums);
+   }
+
+   void inverseSquareField(int numMag, int numObj, double const* mag, double const* obj,
+      double const* weights, double* field) const
+   {
+      fieldOf(numMag, numObj, mag, obj, weights, field);
+   }
+
+   void inverseSquareField(int numMag, int numObj, float const* mag, float const* obj,
+      float const* weights, double* field) const
+   {
+      fieldOf(numMag, numObj, mag, obj, weights, field);
+   }
+
+private:
+   template <typename T>
+   static void sumsOf(int numMag, int numObjects, const int* objStart, T const* mag, T const* obj,
+      const double* polarityValues, double* sums)
+   {
+      const int total = objStart[numObjects];
+      for (int k = 0; k < numObjects; k++) {
+         sums[k] = 0;
+         for (int i = 0; i < numMag; i++) {
+            T row = 0;
+            for (int j = objStart[k]; j < objStart[k + 1]; j++) {
+               T dx = mag[i] - obj[j];
+               T dy = mag[numMag + i] - obj[total + j];
+               T dz = mag[2 * numMag + i] - obj[2 * total + j];
+               row += T(1) / (dx * dx + dy * dy + dz * dz);
+            }
+            sums[k] += row / polarityValues[i];
+         }
+      }
+   }
+
+   template <typename T>
+   static void fieldOf(int numMag, int numObj, T const* mag, T const* obj, T const* weights, double* field)
+   {
+      for (int j = 0; j < numObj; j++) {
+         T f[3] = {0, 0, 0};
+         for (int i = 0; i < numMag; i++) {
+            T d[3] = {obj[j] - mag[i], obj[numObj + j] - mag[numMag + i], obj[2 * numObj + j] - mag[2 * numMag + i]};
+            T distSq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            T s = weights[i] / (distSq * std::sqrt(distSq));
+            for (int a = 0; a < 3; a++) {
+               f[a] += s * d[a];
+            }
+         }
+         for (int a = 0; a < 3; a++) {
+            field[a * numObj + j] = f[a];
+         }
+      }
+   }
+};
+
+#ifdef MAGNET_HAVE_TBB
+//TBB tasks over tiles of (magnet block x object block), so both meshes are
+//split and the work scales with the larger one. The tasks run in the
+//caller's task arena, under a host that schedules with TBB they share its
+//workers instead of starting threads of their own
+class TbbBackend : public ComputeBackend
+{
+public:
+   const char* name() const { return "tbb"; }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, double const* mag,
+      double const* obj, const double* polarityValues, double* sums) const
+   {
+      sumsOf(numMag, numObjects, objStart, mag, obj, polarityValues, sums);
+   }
+
+   void inverseSquareSums(int numMag, int numObjects, const int* objStart, float const* mag,
+      float const* obj, const double* polarityValues, double* sums) const
+   {
+      sumsOf(numMag, numObjects, objStart, mag, obj, polarityValues, sums);
+   }
+
+   void inverseSquareField(int numMag, int numObj, double const* mag, double const* obj,
+      double const* weights, double* field) const
+   {
+      fieldOf(numMag, numObj, mag, obj, weights, field);
+   }
+
+   void inverseSquareField(int numMag, int numObj, float const* mag, float const* obj,
+      float const* weights, double* field) const
+   {
+      fieldOf(numMag, numObj, mag, obj, weights, field);
+   }
+
+private:
+   //object vertices per tile keep the rows long enough for the vector loops,
+   //magnet tiles are cut down until there are about TILES of them, several
+   //for every worker of most machines
+   enum { OBJECT_TILE = 4096, MAGNET_TILE = 256, FIELD_TILE = 256, FIELD_MAGNETS = 1024, TILES = 256 };
+
+   //magnet vertices per tile so that there are about TILES tiles, but no
+   //fewer than least and no more than most. The grain only depends on the
+   //sizes, so the tiles are split and joined the same way for any number of
+   //workers and the sums come out the same
+   static int magnetGrain(int numMag, int objectTiles, int least, int most)
+   {
+      const long wanted = TILES;
+      long magnetTiles = (wanted + objectTiles - 1) / objectTiles;
+      long grain = (numMag + magnetTiles - 1) / magnetTiles;
+      grain = grain > most ? most : grain;
+      return grain < least ? least : (int)grain;
+   }
+
+   template <typename T>
+   static void sumsOf(int numMag, int numObjects, const int* objStart, T const* mag, T const* obj,
+      const double* polarityValues, double* sums)
+   {
+      static const int simdLevel = detectSimdLevel();
+      const InverseSquareKernels<T> kernels = inverseSquareKernels<T>(simdLevel);
+      const int total = objStart[numObjects];
+      for (int k = 0; k < numObjects; k++) {
+         sums[k] = 0;
+      }
+      if (numMag == 0 || total == 0) {
+         return;
+      }
+      const int objectTiles = (total + OBJECT_TILE - 1) / OBJECT_TILE;
+      tbb::blocked_range2d<int> tiles(0, numMag, magnetGrain(numMag, objectTiles, 1, MAGNET_TILE),
+         0, total, OBJECT_TILE);
+
+      //every tile sums its pairs into its own copy of the per object sums, the
+      //deterministic reduce splits and joins the same way for any worker count
+      std::vector<double> result = tbb::parallel_deterministic_reduce(tiles, std::vector<double>(numObjects, 0.0),
+         [&](const tbb::blocked_range2d<int>& tile, std::vector<double> partial) {
+            const int lo = tile.cols().begin(), hi = tile.cols().end();
+            //objects overlapping the tile's vertex range
+            int first = std::upper_bound(objStart, objStart + numObjects + 1, lo) - objStart - 1;
+            for (int i = tile.rows().begin(); i < tile.rows().end(); i++) {
+               for (int k = first; k < numObjects && objStart[k] < hi; k++) {
+                  const int start = objStart[k] > lo ? objStart[k] : lo;
+                  const int end = objStart[k + 1] < hi ? objStart[k + 1] : hi;
+                  if (end > start) {
+                     partial[k] += kernels.row(mag[i], mag[numMag + i], mag[2 * numMag + i],
+                        obj + start, obj + total + start, obj + 2 * total + start, end - start) / polarityValues[i];
+                  }
+               }
+            }
+            return partial;
+         },
+         [](std::vector<double> a, const std::vector<double>& b) {
+            for (size_t k = 0; k < a.size(); k++) {
+               a[k] += b[k];
+            }
+            return a;
+         });
+      for (int k = 0; k < numObjects; k++) {
+         sums[k] = result[k];
+      }
+   }
+
+   template <typename T>
+   static void fieldOf(int numMag, int numObj, T const* mag, T const* obj, T const* weights, double* field)
+   {
+      static const int simdLevel = detectSimdLevel();
+      const InverseSquareKernels<T> kernels = inverseSquareKernels<T>(simdLevel);
+      if (numMag == 0 || numObj == 0) {
+         for (int j = 0; j < numObj * 3; j++) {
+            field[j] = 0;
+         }
+         return;
+      }
+      const int objectTiles = (numObj + FIELD_TILE - 1) / FIELD_TILE;
+      const int magGrain = magnetGrain(numMag, objectTiles, FIELD_MAGNETS, numMag);
+
+      //object blocks in parallel, and inside each block the magnet is split
+      //as well when there are too few blocks to go around
+      tbb::parallel_for(tbb::blocked_range<int>(0, numObj, FIELD_TILE), [&](const tbb::blocked_range<int>& vertices) {
+         const int lo = vertices.begin(), n = vertices.end() - vertices.begin();
+         std::vector<double> f = tbb::parallel_deterministic_reduce(
+            tbb::blocked_range<int>(0, numMag, magGrain),
+            std::vector<double>(n * 3, 0.0),
+            [&](const tbb::blocked_range<int>& magnets, std::vector<double> partial) {
+               const int m0 = magnets.begin();
+               for (int j = 0; j < n; j++) {
+                  double column[3];
+                  kernels.column(obj[lo + j], obj[numObj + lo + j], obj[2 * numObj + lo + j],
+                     mag + m0, mag + numMag + m0, mag + 2 * numMag + m0, weights + m0, magnets.end() - m0, column);
+                  partial[j] += column[0];
+                  partial[n + j] += column[1];
+                  partial[2 * n + j] += column[2];
+               }
+               return partial;
+            },
+            [](std::vector<double> a, const std::vector<double>& b) {
+               for (size_t k = 0; k < a.size(); k++) {
+                  a[k] += b[k];
+               }
+               return a;
+            });
+         for (int j = 0; j < n; j++) {
+            field[lo + j] = f[j];
+            field[numObj + lo + j] = f[n + j];
+            field[2 * numObj + lo + j] = f[2 * n + j];
+         }
+      });
+   }
+};
+#endif
+
+const ComputeBackend* computeBackend(int type)
+{
+   static const OpenMPBackend simd("simd", detectSimdLevel());
+   static const OpenMPBackend openmp("openmp", SIMD_BASELINE);
+   static const ScalarBackend scalar;
+#ifdef MAGNET_HAVE_TBB
+   static const TbbBackend tbb;
+#endif
+
+   switch (type) {
+   case BACKEND_SIMD:
+      return &simd;
+   case BACKEND_OPENMP:
+      return &openmp;
+   case BACKEND_SCALAR:
+      return &scalar;
+#ifdef MAGNET_HAVE_TBB
+   case BACKEND_TBB:
+      return &tbb;
+#endif
+   default:
+      return NULL;
+   }
+}
+
+const ComputeBackend* computeBackendOrDefault(int type)
+{
+   const ComputeBackend* backend = computeBackend(type);
+   return backend ? backend : computeBackend(BACKEND_SIMD);
+}
+
+const char* backendName(int type)
+{
+   static const char* names[NUM_BACKENDS] = {"simd", "openmp", "scalar", "tbb"};
+   return type >= 0 && type < NUM_BACKENDS ? names[type] : "unknown";
+}
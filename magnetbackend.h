@@ -0,0 +1,54 @@
+//
+//  File: magnetbackend.h
+//
+//  Description:
+//    Compute backends for the exact O(numMag * numObj) kernels, the influence
+//    sum behind magnetForce and the field behind magnetField. Every backend
+//    gives the same result up to summation order, they only differ in how
+//    the pairs are spread over threads and vector lanes, so the fastest one
+//    can be picked per machine. New backends only need a ComputeBackend
+//    subclass and an entry in computeBackend.
+//
+
+#ifndef MAGNETBACKEND_H
+#define MAGNETBACKEND_H
+
+//values of the node's offload attribute, BACKEND_SIMD is the default
+enum BackendType {
+   BACKEND_SIMD,      //OpenMP threads, rows compiled for the widest instruction set
+   BACKEND_OPENMP,    //OpenMP threads, rows compiled for the baseline instruction set
+   BACKEND_SCALAR,    //one thread, one pair at a time, the reference
+   BACKEND_TBB,       //TBB tasks, rows compiled for the widest instruction set
+   NUM_BACKENDS
+};
+
+class ComputeBackend
+{
+public:
+   virtual ~ComputeBackend() {}
+
+   virtual const char* name() const = 0;
+
+   //see inverseSquareSums in magnetcore.h
+   virtual void inverseSquareSums(int numMag, int numObjects, const int* objStart, double const* mag,
+      double const* obj, const double* polarityValues, double* sums) const = 0;
+   virtual void inverseSquareSums(int numMag, int numObjects, const int* objStart, float const* mag,
+      float const* obj, const double* polarityValues, double* sums) const = 0;
+
+   //see inverseSquareField in magnetcore.h
+   virtual void inverseSquareField(int numMag, int numObj, double const* mag, double const* obj,
+      double const* weights, double* field) const = 0;
+   virtual void inverseSquareField(int numMag, int numObj, float const* mag, float const* obj,
+      float const* weights, double* field) const = 0;
+};
+
+//backend of the given type, NULL when it is not compiled in (TBB without
+//MAGNET_HAVE_TBB) or the type is out of range
+const ComputeBackend* computeBackend(int type);
+
+//computeBackend, falling back to BACKEND_SIMD when the type is not available
+const ComputeBackend* computeBackendOrDefault(int type);
+
+const char* backendName(int type);
+
+#endif
@@ -0,0 +1,1077 @@
+//
+//  File: magnetbench.cpp
+//
+//  Description:
+//    Standalone timing driver for magnetForce and magnetField. Builds two
+//    synthetic point clouds and times the kernel for 1 to N OpenMP threads. With -validate it
+//    instead reports the error of the Barnes-Hut approximation against the
+//    exact influence sum across mesh sizes and opening angles, and with -simd
+//    it compares the instruction sets the influence kernel is compiled for.
+//    -precision compares the single and double precision influence sums.
+//    -cutoff reports the error of the influence radius against the full sum.
+//    -backends compares the compute backends with the scalar reference.
+//    -tiles times the exact kernels untiled and over a range of tile sizes
+//    on meshes larger than the cache, with the DRAM traffic each one implies.
+//    -substeps steps a batch with one object close to the magnet once, with
+//    adaptive sub-steps and oversampled, and compares cost and the gap left.
+//    -lod runs whole evaluations on level of detail proxies of several sizes
+//    and reports their time and how far the outputs are from the full meshes.
+//    -stress evaluates many stand-in deformer nodes through the pipeline at
+//    once, the way a host with parallel evaluation does, with evaluations of
+//    the same node and magnet changes racing each other, and checks every
+//    frame against a serial run.
+//    -sweep times every kernel variant over a grid of mesh sizes and thread
+//    counts and can write the results as JSON to compare builds.
+//
+//    make -f Makefile.core magnetbench
+//    ./magnetbench [magnet vertices] [object vertices] [max threads] [repeats]
+//    ./magnetbench -validate [largest vertex count]
+//    ./magnetbench -simd [magnet vertices] [object vertices] [repeats]
+//    ./magnetbench -precision [largest vertex count]
+//    ./magnetbench -cutoff [largest vertex count]
+//    ./magnetbench -backends [magnet vertices] [object vertices] [repeats]
+//    ./magnetbench -tiles [magnet vertices] [object vertices] [repeats]
+//    ./magnetbench -substeps [objects] [vertices] [max sub-steps] [tesla]
+//    ./magnetbench -lod [magnet vertices] [object vertices]
+//    ./magnetbench -stress [nodes] [threads] [frames] [vertices]
+//    ./magnetbench -sweep [-min n] [-max n] [-threads 1,2,4] [-max-pairs n]
+//                         [-repeats n] [-json results.json]
+//
+
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "magnetcache.h"
+#include "magnetcore.h"
+#include "standinhost.h"
+
+//fills the planar buffer pts with n points on a sphere of the given radius
+//around (cx, cy, cz)
+static void makeSphere(double* pts, int n, double radius, double cx, double cy, double cz)
+{
+   const double golden = M_PI * (3.0 - sqrt(5.0));
+   for (int i = 0; i < n; i++) {
+      double y = 1.0 - 2.0 * (i + 0.5) / n;
+      double r = sqrt(1.0 - y * y);
+      double theta = golden * i;
+      pts[i] = cx + radius * r * cos(theta);
+      pts[n + i] = cy + radius * y;
+      pts[2 * n + i] = cz + radius * r * sin(theta);
+   }
+}
+
+//compares the octree influence sum with the exact one for growing meshes
+static int validate(int maxPoints)
+{
+   const double angles[] = {0.25, 0.5, 0.75, 1.0};
+   const int numAngles = sizeof(angles) / sizeof(angles[0]);
+
+   printf("%8s %8s %12s %8s %12s %12s\n", "magnet", "object", "exact (s)", "angle", "approx (s)", "rel error");
+   for (int n = 1000; n <= maxPoints; n *= 4) {
+      double* mag = (double *)malloc(sizeof(double) * n * 3);
+      double* obj = (double *)malloc(sizeof(double) * n * 3);
+      double* polarity = (double *)malloc(sizeof(double) * n);
+      double* weights = (double *)malloc(sizeof(double) * n);
+
+      makeSphere(mag, n, 1.0, 0.0, 0.0, 4.0);
+      makeSphere(obj, n, 1.5, 0.5, 0.0, 1.0);
+      magnetPolarity(n, mag, polarity);
+      for (int i = 0; i < n; i++) {
+         weights[i] = 1.0 / polarity[i];
+      }
+
+      double start = omp_get_wtime();
+      double exact = inverseSquareSum(n, n, mag, obj, polarity, detectSimdLevel());
+      double exactTime = omp_get_wtime() - start;
+
+      Octree magOctree;
+      magOctree.build(mag, weights, n);
+      for (int a = 0; a < numAngles; a++) {
+         start = omp_get_wtime();
+         double approx = magOctree.inverseSquareSum(n, obj, angles[a]);
+         double approxTime = omp_get_wtime() - start;
+         printf("%8d %8d %12.6f %8.2f %12.6f %12.3e\n", n, n, exactTime, angles[a], approxTime,
+            fabs(approx - exact) / fabs(exact));
+      }
+
+      free(mag);
+      free(obj);
+      free(polarity);
+      free(weights);
+   }
+   return 0;
+}
+
+//compares the cutoff influence sum and the resulting translation with the
+//full ones for growing meshes and influence radii
+static int cutoff(int maxPoints)
+{
+   const double radii[] = {0.5, 1.0, 2.0, 4.0, 8.0};
+   const int numRadii = sizeof(radii) / sizeof(radii[0]);
+
+   printf("%8s %8s %12s %8s %12s %12s %12s\n", "magnet", "object", "full (s)", "radius", "cutoff (s)",
+      "sum error", "move error");
+   for (int n = 1000; n <= maxPoints; n *= 4) {
+      double* mag = (double *)malloc(sizeof(double) * n * 3);
+      double* obj = (double *)malloc(sizeof(double) * n * 3);
+      double* moved = (double *)malloc(sizeof(double) * n * 3);
+      double* reference = (double *)malloc(sizeof(double) * n * 3);
+      double* polarity = (double *)malloc(sizeof(double) * n);
+      double* weights = (double *)malloc(sizeof(double) * n);
+
+      makeSphere(mag, n, 1.0, 0.0, 0.0, 4.0);
+      makeSphere(obj, n, 1.5, 0.5, 0.0, 1.0);
+      magnetPolarity(n, mag, polarity);
+      for (int i = 0; i < n; i++) {
+         weights[i] = 1.0 / polarity[i];
+      }
+      KdTree magTree;
+      Octree magOctree;
+      CellGrid magGrid;
+      magTree.build(mag, n);
+
+      double start = omp_get_wtime();
+      double full = inverseSquareSum(n, n, mag, obj, polarity, detectSimdLevel());
+      double fullTime = omp_get_wtime() - start;
+
+      //tesla is picked so the full translation is 0.1 long, below the clamp
+      double teslaValue = 0.1 * n / fabs(full);
+      memcpy(reference, obj, sizeof(double) * n * 3);
+      magnetForce(n, n, teslaValue, mag, magTree, magOctree, 0, magGrid, 0, reference, polarity, 1, false, 
+         BACKEND_SIMD);
+
+      for (int r = 0; r < numRadii; r++) {
+         //a radius that covers every pair runs the exact sum, as magnetForce does
+         magGrid.build(mag, weights, n, radii[r]);
+         int objStart[2] = {0, n};
+         double sum;
+         start = omp_get_wtime();
+         if (!cutoffSums(magGrid, 1, objStart, obj, &sum)) {
+            sum = inverseSquareSum(n, n, mag, obj, polarity, detectSimdLevel());
+         }
+         double cutoffTime = omp_get_wtime() - start;
+
+         memcpy(moved, obj, sizeof(double) * n * 3);
+         magnetForce(n, n, teslaValue, mag, magTree, magOctree, 0, magGrid, radii[r], moved, polarity, 1, 
+            false, BACKEND_SIMD);
+         double move = 0, diff = 0;
+         for (int a = 0; a < 3; a++) {
+            move += (reference[a * n] - obj[a * n]) * (reference[a * n] - obj[a * n]);
+            diff += (moved[a * n] - reference[a * n]) * (moved[a * n] - reference[a * n]);
+         }
+
+         printf("%8d %8d %12.6f %8.2f %12.6f %12.3e %12.3e\n", n, n, fullTime, radii[r], cutoffTime,
+            fabs(sum - full) / fabs(full), sqrt(diff / move));
+      }
+
+      free(mag);
+      free(obj);
+      free(moved);
+      free(reference);
+      free(polarity);
+      free(weights);
+   }
+   return 0;
+}
+
+//times the exact influence kernel on one thread for every instruction set
+//the cpu supports, in double and in single precision
+static int simd(int numMag, int numObj, int repeats)
+{
+   double* mag = (double *)malloc(sizeof(double) * numMag * 3);
+   double* obj = (double *)malloc(sizeof(double) * numObj * 3);
+   double* polarity = (double *)malloc(sizeof(double) * numMag);
+
+   makeSphere(mag, numMag, 1.0, 0.0, 0.0, 4.0);
+   makeSphere(obj, numObj, 1.5, 0.5, 0.0, 1.0);
+   magnetPolarity(numMag, mag, polarity);
+   omp_set_num_threads(1);
+
+   printf("magnet vertices %d, object vertices %d, repeats %d\n", numMag, numObj, repeats);
+   printf("%14s %12s %12s %9s %12s\n", "kernel", "seconds", "Mpairs/s", "speedup", "rel error");
+
+   float* magSingle = toSinglePrecision(mag, numMag * 3);
+   float* objSingle = toSinglePrecision(obj, numObj * 3);
+
+   double baseline = 0, reference = 0;
+   for (int single = 0; single < 2; single++) {
+      for (int level = SIMD_BASELINE; level <= detectSimdLevel(); level++) {
+         double best = DBL_MAX, sum = 0;
+         for (int r = 0; r < repeats; r++) {
+            double start = omp_get_wtime();
+            sum = single ? inverseSquareSum(numMag, numObj, magSingle, objSingle, polarity, level)
+               : inverseSquareSum(numMag, numObj, mag, obj, polarity, level);
+            double elapsed = omp_get_wtime() - start;
+            best = elapsed < best ? elapsed : best;
+         }
+         if (!single && level == SIMD_BASELINE) {
+            baseline = best;
+            reference = sum;
+         }
+         printf("%7s %-6s %12.6f %12.1f %8.2fx %12.3e\n", simdLevelName(level), single ? "float" : "double", 
+            best, (double)numMag * numObj / best * 1e-6, baseline / best, fabs(sum - reference) / fabs(reference));
+      }
+   }
+
+   free(magSingle);
+   free(objSingle);
+   free(mag);
+   free(obj);
+   free(polarity);
+   return 0;
+}
+
+//times the exact influence sum and field with every compute backend that is
+//compiled in and compares them with the scalar reference backend
+static int backends(int numMag, int numObj, int repeats)
+{
+   double* mag = (double *)malloc(sizeof(double) * numMag * 3);
+   double* obj = (double *)malloc(sizeof(double) * numObj * 3);
+   double* polarity = (double *)malloc(sizeof(double) * numMag);
+   double* weights = (double *)malloc(sizeof(double) * numMag);
+   double* field = (double *)malloc(sizeof(double) * numObj * 3);
+   double* referenceField = (double *)malloc(sizeof(double) * numObj * 3);
+
+   makeSphere(mag, numMag, 1.0, 0.0, 0.0, 4.0);
+   makeSphere(obj, numObj, 1.5, 0.5, 0.0, 1.0);
+   magnetPolarity(numMag, mag, polarity);
+   for (int i = 0; i < numMag; i++) {
+      weights[i] = 1.0 / polarity[i];
+   }
+   int objStart[2] = {0, numObj};
+
+   printf("magnet vertices %d, object vertices %d, threads %d, repeats %d\n", numMag, numObj, 
+      omp_get_max_threads(), repeats);
+   printf("%8s %12s %12s %12s %12s\n", "backend", "sum (s)", "sum error", "field (s)", "field error");
+
+   //the scalar backend goes first, everything else is compared with it
+   const int order[NUM_BACKENDS] = {BACKEND_SCALAR, BACKEND_OPENMP, BACKEND_SIMD, BACKEND_TBB};
+   double reference = 0;
+   for (int b = 0; b < NUM_BACKENDS; b++) {
+      const ComputeBackend* backend = computeBackend(order[b]);
+      if (!backend) {
+         printf("%8s %12s\n", backendName(order[b]), "not built");
+         continue;
+      }
+      double sumTime = DBL_MAX, fieldTime = DBL_MAX, sum = 0;
+      for (int r = 0; r < repeats; r++) {
+         double start = omp_get_wtime();
+         backend->inverseSquareSums(numMag, 1, objStart, mag, obj, polarity, &sum);
+         double elapsed = omp_get_wtime() - start;
+         sumTime = elapsed < sumTime ? elapsed : sumTime;
+
+         start = omp_get_wtime();
+         backend->inverseSquareField(numMag, numObj, mag, obj, weights, field);
+         elapsed = omp_get_wtime() - start;
+         fieldTime = elapsed < fieldTime ? elapsed : fieldTime;
+      }
+      if (order[b] == BACKEND_SCALAR) {
+         reference = sum;
+         memcpy(referenceField, field, sizeof(double) * numObj * 3);
+      }
+      double fieldError = 0, fieldSize = 0;
+      for (int j = 0; j < numObj * 3; j++) {
+         fieldError = fmax(fieldError, fabs(field[j] - referenceField[j]));
+         fieldSize = fmax(fieldSize, fabs(referenceField[j]));
+      }
+      printf("%8s %12.6f %12.3e %12.6f %12.3e\n", backend->name(), sumTime, fabs(sum - reference) / fabs(reference),
+         fieldTime, fieldError / fieldSize);
+   }
+
+   free(mag);
+   free(obj);
+   free(polarity);
+   free(weights);
+   free(field);
+   free(referenceField);
+   return 0;
+}
+
+//times the exact influence sum and field for several tile lengths. Untiled
+//every magnet row streams the whole object, and every object vertex the
+//whole magnet, from memory. A tile that fits in L2 is read from memory once
+//per block of rows instead, the traffic column is that model in MB
+static int tiles(int numMag, int numObj, int repeats)
+{
+   double* mag = (double *)malloc(sizeof(double) * numMag * 3);
+   double* obj = (double *)malloc(sizeof(double) * numObj * 3);
+   double* polarity = (double *)malloc(sizeof(double) * numMag);
+   double* weights = (double *)malloc(sizeof(double) * numMag);
+   double* field = (double *)malloc(sizeof(double) * numObj * 3);
+   double* referenceField = (double *)malloc(sizeof(double) * numObj * 3);
+
+   makeSphere(mag, numMag, 1.0, 0.0, 0.0, 4.0);
+   makeSphere(obj, numObj, 1.5, 0.5, 0.0, 1.0);
+   magnetPolarity(numMag, mag, polarity);
+   for (int i = 0; i < numMag; i++) {
+      weights[i] = 1.0 / polarity[i];
+   }
+   int objStart[2] = {0, numObj};
+   const int simdLevel = detectSimdLevel();
+   const int threads = omp_get_max_threads();
+   const long l2 = cacheSize(2);
+
+   printf("magnet vertices %d, object vertices %d, threads %d, repeats %d\n", numMag, numObj, threads, repeats);
+   printf("L1 %ld KB, L2 %ld KB, L3 %ld KB, default tiles %d (sum) %d (field) vertices\n", cacheSize(1) >> 10, 
+      l2 >> 10, cacheSize(3) >> 10, cacheTileVertices(3 * sizeof(double)), cacheTileVertices(4 * sizeof(double)));
+   printf("%8s %8s %12s %12s %12s %12s %12s %12s %12s\n", "tile", "KB", "sum (s)", "Mpairs/s", "traffic MB", 
+      "rel error", "field (s)", "traffic MB", "rel error");
+
+   //0 is the untiled loop, -1 the size picked from the cache
+   const int lengths[] = {0, 256, 512, 1024, 2048, 4096, 16384, 65536, 262144, -1};
+   const int numLengths = sizeof(lengths) / sizeof(lengths[0]);
+   const int numBlocks = magnetBlocks(numMag);
+   double reference = 0;
+   for (int t = 0; t < numLengths; t++) {
+      double sumTime = DBL_MAX, fieldTime = DBL_MAX, sum = 0;
+      for (int r = 0; r < repeats; r++) {
+         double start = omp_get_wtime();
+         inverseSquareSums(numMag, 1, objStart, mag, obj, polarity, simdLevel, &sum, lengths[t]);
+         double elapsed = omp_get_wtime() - start;
+         sumTime = elapsed < sumTime ? elapsed : sumTime;
+
+         start = omp_get_wtime();
+         inverseSquareField(numMag, numObj, mag, obj, weights, simdLevel, field, lengths[t]);
+         elapsed = omp_get_wtime() - start;
+         fieldTime = elapsed < fieldTime ? elapsed : fieldTime;
+      }
+      if (lengths[t] == 0) {
+         reference = sum;
+         memcpy(referenceField, field, sizeof(double) * numObj * 3);
+      }
+      double fieldError = 0, fieldSize = 0;
+      for (int j = 0; j < numObj * 3; j++) {
+         fieldError = fmax(fieldError, fabs(field[j] - referenceField[j]));
+         fieldSize = fmax(fieldSize, fabs(referenceField[j]));
+      }
+
+      //passes over the other mesh that miss the cache, one per row when the
+      //tile does not fit, one per block when it does
+      int sumTile = lengths[t] < 0 ? cacheTileVertices(3 * sizeof(double)) : lengths[t] > 0 ? lengths[t] : numObj;
+      int fieldTile = lengths[t] < 0 ? cacheTileVertices(4 * sizeof(double)) : lengths[t] > 0 ? lengths[t] : numMag;
+      sumTile = sumTile < numObj ? sumTile : numObj;
+      fieldTile = fieldTile < numMag ? fieldTile : numMag;
+      double objectBytes = 3.0 * sizeof(double) * numObj;
+      double magnetBytes = 4.0 * sizeof(double) * numMag;
+      double sumPasses = 3.0 * sizeof(double) * sumTile <= l2 ? numBlocks : numMag;
+      double fieldPasses = 4.0 * sizeof(double) * fieldTile <= l2 ? (numObj + FIELD_BLOCK - 1) / FIELD_BLOCK : numObj;
+
+      char name[16];
+      if (lengths[t] == 0) {
+         snprintf(name, sizeof(name), "none");
+      } else {
+         snprintf(name, sizeof(name), lengths[t] < 0 ? "L2 %d" : "%d", sumTile);
+      }
+      printf("%8s %8.0f %12.6f %12.1f %12.1f %12.3e %12.6f %12.1f %12.3e\n", name, 
+         3.0 * sizeof(double) * sumTile / 1024, sumTime, (double)numMag * numObj / sumTime * 1e-6, 
+         sumPasses * objectBytes * 1e-6, fabs(sum - reference) / fabs(reference), 
+         fieldTime, fieldPasses * magnetBytes * 1e-6, fieldError / fieldSize);
+   }
+
+   free(mag);
+   free(obj);
+   free(polarity);
+   free(weights);
+   free(field);
+   free(referenceField);
+   return 0;
+}
+
+//smallest distance between the object vertices start up to end of the
+//planar buffer obj (total vertices) and the magnet
+static double minimumGap(const double* mag, int numMag, const double* obj, int total, int start, int end)
+{
+   double best = DBL_MAX;
+   for (int j = start; j < end; j++) {
+      for (int i = 0; i < numMag; i++) {
+         double dx = obj[j] - mag[i], dy = obj[total + j] - mag[numMag + i];
+         double dz = obj[2 * total + j] - mag[2 * numMag + i];
+         best = fmin(best, dx * dx + dy * dy + dz * dz);
+      }
+   }
+   return sqrt(best);
+}
+
+//one object close to the magnet and the others far away, stepped once, with
+//adaptive sub-steps, and oversampled (maxSubsteps full steps of tesla /
+//maxSubsteps, what raising the evaluation rate costs). Reports the gap the
+//close object is left with and how far the far objects end up from the
+//single step
+static int substeps(int numObjects, int numPoints, int maxSubsteps, double tesla)
+{
+   std::vector<double> mag(numPoints * 3);
+   makeSphere(&mag[0], numPoints, 1.0, 0.0, 0.0, 0.0);
+   MagnetCache magnet;
+   magnet.update(&mag[0], numPoints, hashValues(&mag[0], sizeof(double) * numPoints * 3, numPoints));
+
+   const int total = numObjects * numPoints;
+   std::vector<double> start(total * 3), single(total * 3), work(total * 3);
+   std::vector<int> objStart(numObjects + 1);
+   std::vector<double> sphere(numPoints * 3);
+   for (int k = 0; k < numObjects; k++) {
+      //object 0 sits 0.3 above the magnet, the others several radii away
+      makeSphere(&sphere[0], numPoints, 0.5, k ? 4.0 + 3.0 * k : 0.0, 0.0, k ? 0.0 : 1.8);
+      for (int c = 0; c < 3; c++) {
+         memcpy(&start[c * total + k * numPoints], &sphere[c * numPoints], sizeof(double) * numPoints);
+      }
+      objStart[k] = k * numPoints;
+   }
+   objStart[numObjects] = total;
+
+   printf("%d objects of %d vertices, magnet %d vertices, tesla %g, at most %d sub-steps, %d threads\n",
+      numObjects, numPoints, numPoints, tesla, maxSubsteps, omp_get_max_threads());
+   printf("close object starts %.4f from the magnet\n", minimumGap(&mag[0], numPoints, &start[0], total, 0, numPoints));
+   printf("%12s %12s %12s %12s %16s\n", "object", "mode", "time (s)", "close gap", "far difference");
+
+   //a positive object is pushed away, a negative one pulled in
+   ScratchArena scratch;
+   const char* modes[3] = {"one step", "adaptive", "oversampled"};
+   double closeGap[2][3];
+   for (int polarity = 1; polarity >= 0; polarity--) {
+      for (int m = 0; m < 3; m++) {
+         double best = DBL_MAX;
+         for (int r = 0; r < 3; r++) {
+            work = start;
+            double t0 = omp_get_wtime();
+            if (m == 2) {
+               for (int s = 0; s < maxSubsteps; s++) {
+                  scratch.reset();
+                  magnet.forceBatch(numObjects, &objStart[0], tesla / maxSubsteps, 0, &work[0], polarity, false, 
+                     BACKEND_SIMD, &scratch);
+               }
+            } else {
+               scratch.reset();
+               magnet.forceBatch(numObjects, &objStart[0], tesla, 0, &work[0], polarity, false, BACKEND_SIMD,
+                  &scratch, m == 1 ? maxSubsteps : 1);
+            }
+            best = fmin(best, omp_get_wtime() - t0);
+         }
+         if (m == 0) {
+            single = work;
+         }
+         double farDifference = 0;
+         for (int c = 0; c < 3; c++) {
+            for (int j = numPoints; j < total; j++) {
+               farDifference = fmax(farDifference, fabs(work[c * total + j] - single[c * total + j]));
+            }
+         }
+         closeGap[polarity][m] = minimumGap(&mag[0], numPoints, &work[0], total, 0, numPoints);
+         printf("%12s %12s %12.6f %12.4f %16.3e\n", polarity ? "positive" : "negative", modes[m], best, 
+            closeGap[polarity][m], farDifference);
+      }
+   }
+
+   //the pulled in object closes at most SUBSTEP_GAP of its gap per sub-step,
+   //so short of what is left after maxSubsteps it has to end where the
+   //oversampled run does
+   double startGap = minimumGap(&mag[0], numPoints, &start[0], total, 0, numPoints);
+   double allowed = startGap * pow(1 - SUBSTEP_GAP, maxSubsteps) * (1 + 1e-6);
+   if (fabs(closeGap[0][1] - closeGap[0][2]) > allowed) {
+      printf("adaptive leaves the negative object %.4f from the oversampled gap, more than %.4f\n",
+         fabs(closeGap[0][1] - closeGap[0][2]), allowed);
+      return 1;
+   }
+   return 0;
+}
+
+//a few frames of a magnet turning next to an object, evaluated through the
+//pipeline on the full meshes and on proxies of several sizes, in translate
+//and falloff mode. Proxies counts the magnet proxies and object points the
+//kernel sees. The first frame clusters the meshes and is not timed, the
+//error is the largest distance of an output vertex from the full meshes'
+//output over the largest distance the full meshes moved a vertex
+static int lod(int numMag, int numObj)
+{
+   const int frames = 4;
+   std::vector<double> mag(numMag * 3), turned(numMag * 3), obj(numObj * 3);
+   makeSphere(&mag[0], numMag, 1.0, 0.0, 0.0, 0.0);
+   makeSphere(&obj[0], numObj, 0.5, 0.0, 0.0, 1.8);
+
+   printf("magnet %d vertices, object %d vertices, %d frames, %d threads\n", numMag, numObj, frames,
+      omp_get_max_threads());
+   printf("%10s %12s %12s %14s %12s\n", "mode", "per proxy", "proxies", "frame (ms)", "error");
+   const int sizes[] = {0, 2, 4, 8, 16, 32, 64};
+   const int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+   for (int falloff = 0; falloff < 2; falloff++) {
+      std::vector<double> full;
+      double fullMove = 0;
+      for (int s = 0; s < numSizes; s++) {
+         StandInHost host;
+         host.addMagnet(&mag[0], numMag, 1.0);
+         host.addGeometry(0, &obj[0], numObj);
+         MagnetPipeline pipeline;
+         PipelineSettings settings;
+         settings.tesla = 1.0;
+         settings.falloff = falloff != 0;
+         settings.proxyVertices = sizes[s];
+         double seconds = 0;
+         for (int f = 0; f < frames; f++) {
+            //a small turn about x, so the magnet's z range changes every frame
+            const double c = cos(0.05 * f), sn = sin(0.05 * f);
+            for (int i = 0; i < numMag; i++) {
+               turned[i] = mag[i];
+               turned[numMag + i] = c * mag[numMag + i] - sn * mag[2 * numMag + i];
+               turned[2 * numMag + i] = sn * mag[numMag + i] + c * mag[2 * numMag + i];
+            }
+            host.setMagnetPoints(0, &turned[0], numMag);
+            pipeline.magnetChanged();
+            host.pull();
+            double t0 = omp_get_wtime();
+            pipeline.evaluate(host, settings);
+            if (f > 0) {
+               seconds += omp_get_wtime() - t0;
+            }
+         }
+
+         int n;
+         const double* out = host.output(0, &n);
+         double error = 0;
+         if (s == 0) {
+            full.assign(out, out + 4 * n);
+            for (int i = 0; i < n; i++) {
+               double dx = out[4 * i] - obj[i], dy = out[4 * i + 1] - obj[n + i];
+               double dz = out[4 * i + 2] - obj[2 * n + i];
+               fullMove = fmax(fullMove, sqrt(dx * dx + dy * dy + dz * dz));
+            }
+         } else {
+            for (int i = 0; i < n; i++) {
+               double dx = out[4 * i] - full[4 * i], dy = out[4 * i + 1] - full[4 * i + 1];
+               double dz = out[4 * i + 2] - full[4 * i + 2];
+               error = fmax(error, sqrt(dx * dx + dy * dy + dz * dz));
+            }
+         }
+         //falloff keeps the object's vertices
+         int proxies = sizes[s] ? (numMag + sizes[s] - 1) / sizes[s] : numMag;
+         proxies += sizes[s] && !falloff ? (numObj + sizes[s] - 1) / sizes[s] : numObj;
+         printf("%10s %12d %12d %14.3f %12.3e\n", falloff ? "falloff" : "translate", sizes[s] ? sizes[s] : 1,
+            proxies, seconds * 1000.0 / (frames - 1), fullMove > 0 ? error / fullMove : error);
+      }
+   }
+   return 0;
+}
+
+//one deformer node: its scene (a stand-in host with the magnet and two
+//geometries at sparse logical indices), the pipeline it evaluates and the
+//outputs of every frame, planar per geometry one after the other
+struct StandInNode
+{
+   StandInHost host;
+   MagnetPipeline pipeline;
+   PipelineSettings settings;
+   char bakePath[256];
+   std::vector<double> results;
+};
+
+//nodes of four kinds side by side: exact, Barnes-Hut, cutoff, and exact
+//recording a bake. Every fifth node plays its frames back from a bake
+//recorded before the runs instead
+static void resetNodes(std::vector<StandInNode*>& nodes, int frames, const std::vector<double>& sphere,
+   int numObj, bool playback)
+{
+   const int numMag = (int)sphere.size() / 3;
+   std::vector<double> obj(numObj * 3);
+   for (int k = 0; k < (int)nodes.size(); k++) {
+      delete nodes[k];
+      StandInNode& node = *(nodes[k] = new StandInNode);
+      node.host.addMagnet(&sphere[0], numMag, 1.0);
+      for (int g = 0; g < 2; g++) {
+         makeSphere(&obj[0], numObj, 1.5, 0.5 + 0.5 * g, 0.0, 1.0 + 0.01 * k);
+         node.host.addGeometry(2 * g, &obj[0], numObj);
+      }
+      node.settings.tesla = 0.05;
+      node.settings.openingAngle = k % 4 == 1 ? 0.5 : 0;
+      node.settings.influenceRadius = k % 4 == 2 ? 2.0 : 0;
+      snprintf(node.bakePath, sizeof(node.bakePath), "magnetbench-stress-%d.bake", k);
+      node.settings.bakeFile = node.bakePath;
+      node.settings.bakeMode = k % 5 == 4 ? (playback ? BAKE_PLAYBACK : BAKE_RECORD)
+         : k % 4 == 3 ? BAKE_RECORD : BAKE_OFF;
+      node.results.assign(frames * 2 * numObj * 3, 0);
+   }
+}
+
+//what the host does before evaluating a node: the magnet turns rigidly about
+//its node's axis, the host flags it changed and copies the inputs into the
+//outputs
+static void pullFrame(StandInNode& node, int index, int frame, const std::vector<double>& sphere,
+   std::vector<double>& mag)
+{
+   const int numMag = (int)sphere.size() / 3;
+   double angle = 0.05 * frame + index;
+   double c = cos(angle), s = sin(angle);
+   for (int i = 0; i < numMag; i++) {
+      double x = sphere[i] - 0.5, y = sphere[numMag + i];
+      mag[i] = c * x - s * y + 0.5;
+      mag[numMag + i] = s * x + c * y;
+      mag[2 * numMag + i] = sphere[2 * numMag + i];
+   }
+   node.host.setMagnetPoints(0, &mag[0], numMag);
+   node.pipeline.magnetChanged();
+   node.host.pull();
+}
+
+//keeps the outputs of both geometries of a node for the frame
+static void keepFrame(StandInNode& node, int frame)
+{
+   for (int g = 0; g < 2; g++) {
+      int n;
+      const double* out = node.host.output(g, &n);
+      double* kept = &node.results[(frame * 2 + g) * n * 3];
+      for (int i = 0; i < n; i++) {
+         kept[i] = out[4 * i];
+         kept[n + i] = out[4 * i + 1];
+         kept[2 * n + i] = out[4 * i + 2];
+      }
+   }
+}
+
+//every frame asks each node for two evaluations and flags its magnet changed
+//once more, the way a host asking for two outputGeom elements while an
+//upstream mesh is edited would
+static const int STRESS_TASKS = 3;
+
+static void stressTask(StandInNode& node, int task)
+{
+   if (task == STRESS_TASKS - 1) {
+      node.pipeline.magnetChanged();
+   } else {
+      ScopedLock guard(node.pipeline.evaluationLock());
+      node.pipeline.evaluate(node.host, node.settings);
+   }
+}
+
+//evaluates numNodes stand-in nodes through MagnetPipeline for the given
+//frames, first one node at a time and then with the nodes spread over
+//threads like a host evaluating independent deformers in parallel. In the
+//parallel run the two evaluations of a node and the extra magnetChanged
+//run as separate tasks, so they race on the same pipeline. Every node owns
+//its caches, so both runs have to produce the same outputs on every frame,
+//up to the rounding of kernels that split their sums over other thread
+//counts
+static int stress(int numNodes, int threads, int frames, int numPoints)
+{
+   std::vector<double> sphere(numPoints * 3), mag(numPoints * 3);
+   makeSphere(&sphere[0], numPoints, 1.0, 0.0, 0.0, 4.0);
+   std::vector<StandInNode*> nodes(numNodes, (StandInNode*)NULL);
+   printf("nodes %d, threads %d, frames %d, magnet and object vertices %d\n", numNodes, threads, frames, numPoints);
+
+   //the bakes the playback nodes read
+   resetNodes(nodes, frames, sphere, numPoints, false);
+   for (int k = 4; k < numNodes; k += 5) {
+      for (int f = 0; f < frames; f++) {
+         nodes[k]->settings.frame = f;
+         pullFrame(*nodes[k], k, f, sphere, mag);
+         nodes[k]->pipeline.evaluate(nodes[k]->host, nodes[k]->settings);
+      }
+   }
+
+   resetNodes(nodes, frames, sphere, numPoints, true);
+   double start = omp_get_wtime();
+   for (int k = 0; k < numNodes; k++) {
+      for (int f = 0; f < frames; f++) {
+         nodes[k]->settings.frame = f;
+         pullFrame(*nodes[k], k, f, sphere, mag);
+         for (int t = 0; t < STRESS_TASKS; t++) {
+            stressTask(*nodes[k], t);
+         }
+         keepFrame(*nodes[k], f);
+      }
+   }
+   double serialTime = omp_get_wtime() - start;
+   std::vector<std::vector<double> > reference(numNodes);
+   for (int k = 0; k < numNodes; k++) {
+      reference[k] = nodes[k]->results;
+   }
+
+   //frames interleave across nodes, so every thread keeps switching between
+   //nodes the way a parallel evaluator does
+   resetNodes(nodes, frames, sphere, numPoints, true);
+   start = omp_get_wtime();
+   for (int f = 0; f < frames; f++) {
+      for (int k = 0; k < numNodes; k++) {
+         nodes[k]->settings.frame = f;
+         pullFrame(*nodes[k], k, f, sphere, mag);
+      }
+      #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+      for (int t = 0; t < numNodes * STRESS_TASKS; t++) {
+         stressTask(*nodes[t / STRESS_TASKS], t % STRESS_TASKS);
+      }
+      for (int k = 0; k < numNodes; k++) {
+         keepFrame(*nodes[k], f);
+      }
+   }
+   double parallelTime = omp_get_wtime() - start;
+
+   int mismatches = 0;
+   double largest = 0;
+   const int frameValues = 2 * numPoints * 3;
+   for (int k = 0; k < numNodes; k++) {
+      for (int f = 0; f < frames; f++) {
+         double difference = 0;
+         for (int i = f * frameValues; i < (f + 1) * frameValues; i++) {
+            difference = fmax(difference, fabs(nodes[k]->results[i] - reference[k][i]));
+         }
+         mismatches += !(difference <= 1e-9);
+         largest = fmax(largest, difference);
+      }
+      remove(nodes[k]->bakePath);
+      delete nodes[k];
+   }
+   printf("%12s %12s %9s %12s %16s\n", "serial (s)", "parallel (s)", "speedup", "mismatches", "largest diff");
+   printf("%12.4f %12.4f %8.2fx %12d %16.3e\n", serialTime, parallelTime, serialTime / parallelTime, mismatches,
+      largest);
+   return mismatches ? 1 : 0;
+}
+
+//compares the single precision influence sum and the resulting translation
+//with the double precision ones for growing meshes
+static int precision(int maxPoints)
+{
+   printf("%8s %8s %12s %12s %12s %12s\n", "magnet", "object", "double (s)", "float (s)", 
+      "sum error", "move error");
+   for (int n = 1000; n <= maxPoints; n *= 4) {
+      double* mag = (double *)malloc(sizeof(double) * n * 3);
+      double* obj = (double *)malloc(sizeof(double) * n * 3);
+      double* moved[2];
+      double* polarity = (double *)malloc(sizeof(double) * n);
+
+      makeSphere(mag, n, 1.0, 0.0, 0.0, 4.0);
+      makeSphere(obj, n, 1.5, 0.5, 0.0, 1.0);
+      magnetPolarity(n, mag, polarity);
+      KdTree magTree;
+      Octree magOctree;
+      CellGrid magGrid;
+      magTree.build(mag, n);
+
+      double sums[2] = {0, 0}, times[2] = {0, 0};
+      for (int single = 0; single < 2; single++) {
+         double start = omp_get_wtime();
+         if (single) {
+            float* magSingle = toSinglePrecision(mag, n * 3);
+            float* objSingle = toSinglePrecision(obj, n * 3);
+            sums[single] = inverseSquareSum(n, n, magSingle, objSingle, polarity, detectSimdLevel());
+            free(magSingle);
+            free(objSingle);
+         } else {
+            sums[single] = inverseSquareSum(n, n, mag, obj, polarity, detectSimdLevel());
+         }
+         times[single] = omp_get_wtime() - start;
+
+      }
+
+      //tesla is picked so the object moves by 0.1, well below the clamp to the closest pair
+      double teslaValue = 0.1 * n / fabs(sums[0]);
+      for (int single = 0; single < 2; single++) {
+         moved[single] = (double *)malloc(sizeof(double) * n * 3);
+         memcpy(moved[single], obj, sizeof(double) * n * 3);
+         magnetForce(n, n, teslaValue, mag, magTree, magOctree, 0, magGrid, 0, moved[single], polarity, 
+            1, single, BACKEND_SIMD);
+      }
+
+      //error of the translation relative to its length, every vertex moves by the same vector
+      double move[3], diff[3];
+      for (int a = 0; a < 3; a++) {
+         move[a] = moved[0][a * n] - obj[a * n];
+         diff[a] = moved[1][a * n] - moved[0][a * n];
+      }
+      double moveError = sqrt(diff[0] * diff[0] + diff[1] * diff[1] + diff[2] * diff[2])
+         / sqrt(move[0] * move[0] + move[1] * move[1] + move[2] * move[2]);
+
+      printf("%8d %8d %12.6f %12.6f %12.3e %12.3e\n", n, n, times[0], times[1],
+         fabs(sums[1] - sums[0]) / fabs(sums[0]), moveError);
+
+      free(mag);
+      free(obj);
+      free(moved[0]);
+      free(moved[1]);
+      free(polarity);
+   }
+   return 0;
+}
+
+//one way of running magnetForce, or magnetField, that the sweep times
+struct Variant
+{
+   const char* name;
+   bool singlePrecision;
+   double openingAngle;   //0 sums every pair
+   bool falloff;          //per vertex field instead of one translation
+   double influenceRadius;   //above 0 skips the pairs further apart
+};
+
+static const Variant variants[] = {
+   {"exact-double", false, 0.0, false, 0.0},
+   {"exact-single", true, 0.0, false, 0.0},
+   {"barnes-hut-0.5", false, 0.5, false, 0.0},
+   {"barnes-hut-1.0", false, 1.0, false, 0.0},
+   {"cutoff-1.0", false, 0.0, false, 1.0},
+   {"cutoff-2.0", false, 0.0, false, 2.0},
+   {"falloff-double", false, 0.0, true, 0.0},
+   {"falloff-single", true, 0.0, true, 0.0},
+   {"falloff-bh-0.5", false, 0.5, true, 0.0},
+   {"falloff-cut-1.0", false, 0.0, true, 1.0},
+};
+
+struct SweepResult
+{
+   const char* variant;
+   int numMag, numObj, threads;
+   double prepare;   //seconds to build the cached magnet data, paid once per magnet
+   double seconds;   //best time of one magnetForce call
+};
+
+static void writeJson(FILE* file, const std::vector<SweepResult>& results, int repeats)
+{
+   char date[64];
+   time_t now = time(NULL);
+   strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+   fprintf(file, "{\n");
+   fprintf(file, "  \"date\": \"%s\",\n", date);
+   fprintf(file, "  \"compiler\": \"%s\",\n", __VERSION__);
+   fprintf(file, "  \"simd\": \"%s\",\n", simdLevelName(detectSimdLevel()));
+   fprintf(file, "  \"processors\": %d,\n", omp_get_num_procs());
+   fprintf(file, "  \"repeats\": %d,\n", repeats);
+   fprintf(file, "  \"results\": [\n");
+   for (size_t r = 0; r < results.size(); r++) {
+      const SweepResult& res = results[r];
+      fprintf(file, "    {\"variant\": \"%s\", \"magnet\": %d, \"object\": %d, \"threads\": %d, "
+         "\"prepare_seconds\": %.9f, \"seconds\": %.9f, \"mpairs_per_second\": %.3f}%s\n",
+         res.variant, res.numMag, res.numObj, res.threads, res.prepare, res.seconds,
+         (double)res.numMag * res.numObj / res.seconds * 1e-6, r + 1 < results.size() ? "," : "");
+   }
+   fprintf(file, "  ]\n}\n");
+}
+
+//times every variant for magnet and object sizes from min to max (times 10 per
+//step) and every requested thread count. Runs above maxPairs are skipped unless
+//they use the octree, cutoff runs too since near full coverage they cost as much
+//as the exact sum
+static int sweep(int argc, char** argv)
+{
+   int minPoints = 1000, maxPoints = 1000000, repeats = 3;
+   double maxPairs = 1e10;
+   const char* jsonPath = NULL;
+   std::vector<int> threadCounts;
+
+   for (int a = 2; a < argc; a++) {
+      if (!strcmp(argv[a], "-min") && a + 1 < argc) {
+         minPoints = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-max") && a + 1 < argc) {
+         maxPoints = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-max-pairs") && a + 1 < argc) {
+         maxPairs = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-repeats") && a + 1 < argc) {
+         repeats = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-json") && a + 1 < argc) {
+         jsonPath = argv[++a];
+      } else if (!strcmp(argv[a], "-threads") && a + 1 < argc) {
+         for (char* t = strtok(argv[++a], ","); t; t = strtok(NULL, ",")) {
+            threadCounts.push_back(atoi(t));
+         }
+      } else {
+         fprintf(stderr, "unknown sweep option %s\n", argv[a]);
+         return 1;
+      }
+   }
+   if (threadCounts.empty()) {
+      for (int t = 1; t < omp_get_num_procs(); t *= 2) {
+         threadCounts.push_back(t);
+      }
+      threadCounts.push_back(omp_get_num_procs());
+   }
+   if (minPoints <= 0 || maxPoints < minPoints || repeats <= 0) {
+      fprintf(stderr, "invalid sweep range\n");
+      return 1;
+   }
+
+   const int numVariants = sizeof(variants) / sizeof(variants[0]);
+   std::vector<SweepResult> results;
+   printf("%-16s %8s %8s %8s %12s %12s %12s\n", "variant", "magnet", "object", "threads", 
+      "prepare (s)", "seconds", "Mpairs/s");
+
+   for (int numMag = minPoints; numMag <= maxPoints; numMag *= 10) {
+      std::vector<double> mag(numMag * 3), polarity(numMag), weights(numMag);
+      makeSphere(&mag[0], numMag, 1.0, 0.0, 0.0, 4.0);
+      magnetPolarity(numMag, &mag[0], &polarity[0]);
+      for (int i = 0; i < numMag; i++) {
+         weights[i] = 1.0 / polarity[i];
+      }
+
+      //magnet data is cached on the node, so it is timed apart from the kernel
+      KdTree magTree;
+      Octree magOctree;
+      double start = omp_get_wtime();
+      magTree.build(&mag[0], numMag);
+      double treeTime = omp_get_wtime() - start;
+      start = omp_get_wtime();
+      magOctree.build(&mag[0], &weights[0], numMag);
+      double octreeTime = omp_get_wtime() - start;
+
+      for (int numObj = minPoints; numObj <= maxPoints; numObj *= 10) {
+         std::vector<double> obj(numObj * 3), work(numObj * 3);
+         makeSphere(&obj[0], numObj, 1.5, 0.5, 0.0, 1.0);
+
+         for (int v = 0; v < numVariants; v++) {
+            const Variant& variant = variants[v];
+            if (variant.openingAngle == 0 && (double)numMag * numObj > maxPairs) {
+               continue;
+            }
+            CellGrid magGrid;
+            start = omp_get_wtime();
+            magGrid.build(&mag[0], &weights[0], numMag, variant.influenceRadius);
+            double gridTime = omp_get_wtime() - start;
+            for (size_t t = 0; t < threadCounts.size(); t++) {
+               omp_set_num_threads(threadCounts[t]);
+               double best = DBL_MAX;
+               ScratchArena scratch;
+               for (int r = 0; r < repeats; r++) {
+                  memcpy(&work[0], &obj[0], sizeof(double) * numObj * 3);
+                  scratch.reset();
+                  start = omp_get_wtime();
+                  if (variant.falloff) {
+                     magnetField(numMag, numObj, 10.0, &mag[0], magTree, magOctree, variant.openingAngle,
+                        magGrid, variant.influenceRadius, &work[0], &polarity[0], 1, variant.singlePrecision, 
+                        BACKEND_SIMD, &scratch);
+                  } else {
+                     magnetForce(numMag, numObj, 10.0, &mag[0], magTree, magOctree, variant.openingAngle, 
+                        magGrid, variant.influenceRadius, &work[0], &polarity[0], 1, variant.singlePrecision, 
+                        BACKEND_SIMD, &scratch);
+                  }
+                  double elapsed = omp_get_wtime() - start;
+                  best = elapsed < best ? elapsed : best;
+               }
+
+               SweepResult res = {variant.name, numMag, numObj, threadCounts[t],
+                  treeTime + (variant.openingAngle > 0 ? octreeTime : 0) + gridTime, best};
+               results.push_back(res);
+               printf("%-16s %8d %8d %8d %12.6f %12.6f %12.1f\n", res.variant, numMag, numObj, 
+                  res.threads, res.prepare, best, (double)numMag * numObj / best * 1e-6);
+               fflush(stdout);
+            }
+         }
+      }
+   }
+
+   if (jsonPath) {
+      FILE* file = fopen(jsonPath, "w");
+      if (!file) {
+         fprintf(stderr, "cannot write %s\n", jsonPath);
+         return 1;
+      }
+      writeJson(file, results, repeats);
+      fclose(file);
+   }
+   return 0;
+}
+
+int main(int argc, char** argv)
+{
+   if (argc > 1 && strcmp(argv[1], "-sweep") == 0) {
+      return sweep(argc, argv);
+   }
+   if (argc > 1 && strcmp(argv[1], "-precision") == 0) {
+      return precision(argc > 2 ? atoi(argv[2]) : 16000);
+   }
+   if (argc > 1 && strcmp(argv[1], "-simd") == 0) {
+      return simd(argc > 2 ? atoi(argv[2]) : 2000, argc > 3 ? atoi(argv[3]) : 20000,
+         argc > 4 ? atoi(argv[4]) : 3);
+   }
+   if (argc > 1 && strcmp(argv[1], "-backends") == 0) {
+      return backends(argc > 2 ? atoi(argv[2]) : 2000, argc > 3 ? atoi(argv[3]) : 20000,
+         argc > 4 ? atoi(argv[4]) : 3);
+   }
+   if (argc > 1 && strcmp(argv[1], "-stress") == 0) {
+      return stress(argc > 2 ? atoi(argv[2]) : 32, argc > 3 ? atoi(argv[3]) : omp_get_num_procs(),
+         argc > 4 ? atoi(argv[4]) : 24, argc > 5 ? atoi(argv[5]) : 2000);
+   }
+   if (argc > 1 && strcmp(argv[1], "-substeps") == 0) {
+      return substeps(argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atoi(argv[3]) : 2000,
+         argc > 4 ? atoi(argv[4]) : 8, argc > 5 ? atof(argv[5]) : 1.0);
+   }
+   if (argc > 1 && strcmp(argv[1], "-lod") == 0) {
+      return lod(argc > 2 ? atoi(argv[2]) : 8000, argc > 3 ? atoi(argv[3]) : 40000);
+   }
+   if (argc > 1 && strcmp(argv[1], "-tiles") == 0) {
+      return tiles(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 1000000,
+         argc > 4 ? atoi(argv[4]) : 3);
+   }
+   if (argc > 1 && strcmp(argv[1], "-cutoff") == 0) {
+      return cutoff(argc > 2 ? atoi(argv[2]) : 16000);
+   }
+   if (argc > 1 && strcmp(argv[1], "-validate") == 0) {
+      return validate(argc > 2 ? atoi(argv[2]) : 16000);
+   }
+
+   int numMag = argc > 1 ? atoi(argv[1]) : 2000;
+   int numObj = argc > 2 ? atoi(argv[2]) : 20000;
+   int maxThreads = argc > 3 ? atoi(argv[3]) : omp_get_num_procs();
+   int repeats = argc > 4 ? atoi(argv[4]) : 3;
+
+   if (numMag <= 0 || numObj <= 0 || maxThreads <= 0 || repeats <= 0) {
+      fprintf(stderr, "usage: %s [magnet vertices] [object vertices] [max threads] [repeats]\n", argv[0]);
+      return 1;
+   }
+
+   double* mag = (double *)malloc(sizeof(double) * numMag * 3);
+   double* obj = (double *)malloc(sizeof(double) * numObj * 3);
+   double* work = (double *)malloc(sizeof(double) * numObj * 3);
+   double* reference = (double *)malloc(sizeof(double) * numObj * 3);
+   double* polarity = (double *)malloc(sizeof(double) * numMag);
+
+   //magnet sits above the object so that every z value stays positive
+   makeSphere(mag, numMag, 1.0, 0.0, 0.0, 4.0);
+   makeSphere(obj, numObj, 1.5, 0.5, 0.0, 1.0);
+   magnetPolarity(numMag, mag, polarity);
+
+   //built once like the cached trees on the deformer node
+   KdTree magTree;
+   Octree magOctree;
+   CellGrid magGrid;
+   double buildStart = omp_get_wtime();
+   magTree.build(mag, numMag);
+   double buildTime = omp_get_wtime() - buildStart;
+
+   printf("magnet vertices %d, object vertices %d, repeats %d\n", numMag, numObj, repeats);
+   printf("magnet tree built in %f seconds\n", buildTime);
+   printf("%8s %12s %9s %s\n", "threads", "seconds", "speedup", "result");
+
+   double baseline = 0;
+   for (int threads = 1; threads <= maxThreads; threads++) {
+      omp_set_num_threads(threads);
+      double best = DBL_MAX;
+
+      for (int r = 0; r < repeats; r++) {
+         memcpy(work, obj, sizeof(double) * numObj * 3);
+         double start = omp_get_wtime();
+         magnetForce(numMag, numObj, 10.0, mag, magTree, magOctree, 0, magGrid, 0, work, polarity, 1, false, 
+            BACKEND_SIMD);
+         double elapsed = omp_get_wtime() - start;
+         best = elapsed < best ? elapsed : best;
+      }
+
+      //the closest pair must not depend on the thread count, only the summation
+      //order of the influence may move the result by rounding
+      if (threads == 1) {
+         baseline = best;
+         memcpy(reference, work, sizeof(double) * numObj * 3);
+      }
+      double diff = 0;
+      for (int j = 0; j < numObj * 3; j++) {
+         double d = fabs(work[j] - reference[j]);
+         diff = d > diff ? d : diff;
+      }
+
+      printf("%8d %12.6f %8.2fx max |delta| %g\n", threads, best, baseline / best, diff);
+   }
+
+   free(mag);
+   free(obj);
+   free(work);
+   free(reference);
+   free(polarity);
+   return 0;
+}
@@ -0,0 +1,250 @@
+//
+//  File: magnetcache.h
+//
+//  Description:
+//    Everything the magnet step needs that only depends on the magnet: its
+//    planar points, the polarity field, and the trees over it. It is filled
+//    once per magnet shape and reused by every evaluation until the magnet
+//    changes.
+//
+//    Several magnets are held as one concatenated point set, so one pass
+//    over the object covers all of them. Each magnet keeps its own polarity
+//    field and strength, both folded into the per point polarity the kernel
+//    divides by.
+//
+//    When the magnet only moved rigidly, the trees are kept. The object is
+//    moved into the frame the trees were built in, the step runs there, and
+//    the result is moved back. Distances, and with them the whole step, do
+//    not change under that motion.
+//
+
+#ifndef MAGNETCACHE_H
+#define MAGNETCACHE_H
+
+#include <algorithm>
+#include <vector>
+
+#include "magnetcore.h"
+
+class MagnetCache
+{
+public:
+   MagnetCache() : count(0), pointsHash(0), extent(0), moved(false) {}
+
+   //replaces the magnet with numMag planar points, hash identifies them (see
+   //hashValues) so callers can skip update when it did not change
+   void update(const double* points, int numMag, unsigned long long hash)
+   {
+      int start[2] = {0, numMag};
+      update(points, numMag, start, 1, hash);
+   }
+
+   //same for numMagnets magnets concatenated into one planar buffer, magnet k
+   //owns points start[k] up to start[k + 1]. Strengths are kept while the
+   //number of magnets stays the same, otherwise they go back to 1. The
+   //polarity of every point is found from its magnet's z range, unless
+   //polarity gives it (e.g. for proxies that each carry several vertices)
+   void update(const double* points, int numMag, const int* start, int numMagnets,
+      unsigned long long hash, const double* polarity = NULL)
+   {
+      bool rigid = numMag > 0 && numMag == tree.size()
+         && fitRigidMotion(numMag, &reference[0], points, frame, rigidTolerance() * extent,
+            rotation, translation);
+
+      count = numMag;
+      pointsHash = hash;
+      world.assign(points, points + numMag * 3);
+      if ((int)strengthValues.size() != numMagnets) {
+         strengthValues.assign(numMagnets, 1.0);
+      }
+      starts.assign(start, start + numMagnets + 1);
+
+      //every magnet's polarity follows its own z range
+      if (polarity) {
+         basePolarity.assign(polarity, polarity + numMag);
+      } else {
+         basePolarity.resize(numMag);
+         for (int k = 0; k < numMagnets; k++) {
+            int n = start[k + 1] - start[k];
+            if (n) {
+               magnetPolarityFromZ(n, points + 2 * numMag + start[k], &basePolarity[start[k]]);
+            }
+         }
+      }
+
+      if (rigid) {
+         //polarity follows the world z range, so the aggregates are refreshed
+         applyStrengths();
+      } else {
+         reference = world;
+         tree.build(points, numMag);
+         extent = pickRigidFrame(numMag, points, frame);
+         octree.clear();
+         grid.clear();
+         applyStrengths();
+      }
+      moved = rigid;
+   }
+
+   //signed strength of every magnet. It multiplies the magnet's influence and
+   //a negative strength reverses its polarity
+   void setStrengths(const double* strengths)
+   {
+      int numMagnets = (int)strengthValues.size();
+      if (!std::equal(strengths, strengths + numMagnets, strengthValues.begin())) {
+         strengthValues.assign(strengths, strengths + numMagnets);
+         applyStrengths();
+      }
+   }
+
+   //builds the Barnes-Hut tree if it is not there yet, only needed while the
+   //opening angle is above 0
+   void buildOctree()
+   {
+      if (octree.size() != count) {
+         octree.build(frameVerts(), count ? &weights[0] : NULL, count);
+      }
+   }
+
+   //bins the magnet for the given influence radius, 0 drops the grid and
+   //every pair counts again. The grid is rebuilt when the radius changes
+   void buildGrid(double influenceRadius)
+   {
+      if (influenceRadius <= 0) {
+         grid.clear();
+      } else if (grid.size() != count || grid.influenceRadius() != influenceRadius) {
+         grid.build(frameVerts(), count ? &weights[0] : NULL, count, influenceRadius);
+      }
+   }
+
+   //magnetForce against the cached magnet
+   void force(
+      const int numObj,
+      const double tesla,
+      const double openingAngle,
+      double* obj,
+      const int objectPolarity,
+      bool singlePrecision,
+      const int backend,
+      ScratchArena* scratch,
+      int maxSubsteps = 1
+   ) const
+   {
+      int objStart[2] = {0, numObj};
+      forceBatch(1, objStart, tesla, openingAngle, obj, objectPolarity, singlePrecision, backend, scratch,
+         maxSubsteps);
+   }
+
+   //magnetForceBatch against the cached magnet
+   void forceBatch(
+      const int numObjects,
+      const int* objStart,
+      const double tesla,
+      const double openingAngle,
+      double* obj,
+      const int objectPolarity,
+      bool singlePrecision,
+      const int backend,
+      ScratchArena* scratch,
+      int maxSubsteps = 1
+   ) const
+   {
+      const int total = objStart[numObjects];
+      if (moved) {
+         applyRigidMotion(total, rotation, translation, true, obj);
+      }
+      magnetForceBatch(count, numObjects, objStart, tesla, frameVerts(), tree, octree, openingAngle, 
+         grid, grid.influenceRadius(), obj,
+         count ? &polarityValues[0] : NULL, objectPolarity, singlePrecision, backend, scratch, maxSubsteps);
+      if (moved) {
+         applyRigidMotion(total, rotation, translation, false, obj);
+      }
+   }
+
+   //magnetField against the cached magnet, numObj may span several objects
+   void field(
+      const int numObj,
+      const double tesla,
+      const double openingAngle,
+      double* obj,
+      const int objectPolarity,
+      bool singlePrecision,
+      const int backend,
+      ScratchArena* scratch
+   ) const
+   {
+      if (moved) {
+         applyRigidMotion(numObj, rotation, translation, true, obj);
+      }
+      magnetField(count, numObj, tesla, frameVerts(), tree, octree, openingAngle, 
+         grid, grid.influenceRadius(), obj,
+         count ? &polarityValues[0] : NULL, objectPolarity, singlePrecision, backend, scratch);
+      if (moved) {
+         applyRigidMotion(numObj, rotation, translation, false, obj);
+      }
+   }
+
+   int size() const { return count; }
+
+   int magnets() const { return (int)strengthValues.size(); }
+
+   unsigned long long hash() const { return pointsHash; }
+
+   //planar world points of the magnet
+   const double* points() const { return count ? &world[0] : NULL; }
+
+   //magnetPolarity of each magnet's points divided by its strength
+   const double* polarity() const { return count ? &polarityValues[0] : NULL; }
+
+private:
+   //largest distance, relative to the magnet's size, a vertex may stray from
+   //a rigid motion of the magnet before the trees are rebuilt
+   static double rigidTolerance() { return 1e-5; }
+
+   //folds the strengths into the polarity the kernel divides by and into the
+   //octree charges
+   void applyStrengths()
+   {
+      polarityValues.resize(count);
+      weights.resize(count);
+      for (int k = 0; k + 1 < (int)starts.size(); k++) {
+         for (int i = starts[k]; i < starts[k + 1]; i++) {
+            polarityValues[i] = basePolarity[i] / strengthValues[k];
+            weights[i] = 1.0 / polarityValues[i];
+         }
+      }
+      if (count > 0 && octree.size() == count) {
+         octree.reweight(&weights[0]);
+      }
+      if (count > 0 && grid.size() == count) {
+         grid.reweight(&weights[0]);
+      }
+   }
+
+   //points in the frame the trees were built in
+   const double* frameVerts() const
+   {
+      return count == 0 ? NULL : moved ? &reference[0] : &world[0];
+   }
+
+   int count;
+   unsigned long long pointsHash;
+   std::vector<double> world;           //planar points as last given to update
+   std::vector<int> starts;             //first point of every magnet, then count
+   std::vector<double> strengthValues;  //one per magnet, see setStrengths
+   std::vector<double> basePolarity;    //one per point, see magnetPolarity
+   std::vector<double> polarityValues;  //basePolarity over the magnet's strength
+   std::vector<double> weights;         //1 / polarity, the octree charges
+
+   KdTree tree;                         //closest pair queries, built from reference
+   Octree octree;                       //Barnes-Hut sum, built from reference
+   CellGrid grid;                       //cutoff sum, built from reference, see buildGrid
+   std::vector<double> reference;       //planar points the trees were built from
+   int frame[3];                        //points that measure rigid motions, see pickRigidFrame
+   double extent;                       //bounding box diagonal of reference
+   double rotation[9];                  //rigid motion from reference to world
+   double translation[3];
+   bool moved;                          //world is reference moved by rotation/translation
+};
+
+#endif
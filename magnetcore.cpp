@@ -0,0 +1,1369 @@
+//
+//  File: magnetcore.cpp
+//
+//  Description:
+//    Host independent magnet kernel, see magnetcore.h.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <unistd.h>
+
+#include "magnetcore.h"
+
+void closestPair(
+  const KdTree& magTree,
+  const int numObj,
+  double const* obj,
+  int* closMag,
+  int* closObj
+)
+{
+   int objStart[2] = {0, numObj};
+   double closest;
+   closestPairs(magTree, 1, objStart, obj, closMag, closObj, &closest);
+}
+
+void closestPairs(
+  const KdTree& magTree,
+  const int numObjects,
+  const int* objStart,
+  double const* obj,
+  int* closMag,
+  int* closObj,
+  double* closest
+)
+{
+   const int total = objStart[numObjects];
+   for (int k=0; k < numObjects; k++) {
+      closest[k] = DBL_MAX;
+      closMag[k] = 0;
+      closObj[k] = objStart[k];
+   }
+   
+   //one parallel region for every object, threads move on to the next object
+   //without waiting for the others
+   #pragma omp parallel
+   {
+   for (int k=0; k < numObjects; k++) {
+      //closest pair seen by this thread, merged with the others once the loop is done
+      double localClosest = DBL_MAX;
+      int localMag = 0;
+      int localObj = objStart[k];
+      
+      #pragma omp for nowait
+      for (int j=objStart[k]; j < objStart[k + 1]; j++) {
+         double q[3] = {obj[j], obj[total+j], obj[2*total+j]};
+         double dist;
+         int i = magTree.nearest(q, &dist);
+         if (dist < localClosest || (dist == localClosest && i < localMag)) {
+            localClosest = dist;
+            localMag = i;
+            localObj = j;
+         }
+      }
+      
+      //one merge per thread, so the result does not depend on thread count or schedule
+      #pragma omp critical
+      {
+         if (localClosest < closest[k] || (localClosest == closest[k] && 
+            (localMag < closMag[k] || (localMag == closMag[k] && localObj < closObj[k])))) {
+            closest[k] = localClosest;
+            closMag[k] = localMag;
+            closObj[k] = localObj;
+         }
+      }
+   }
+   }
+   
+   //indices are reported relative to each object
+   for (int k=0; k < numObjects; k++) {
+      closObj[k] -= objStart[k];
+   }
+}
+
+const char* simdLevelName(int level)
+{
+   return level == SIMD_AVX512 ? "avx512" : level == SIMD_AVX2 ? "avx2" : "baseline";
+}
+
+long cacheSize(const int level)
+{
+   long size = -1;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+   size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+#endif
+   //sizes of a typical desktop core when the system does not tell
+   if (size <= 0) {
+      size = level == 1 ? 32 << 10 : level == 2 ? 256 << 10 : 8 << 20;
+   }
+   return size;
+}
+
+int cacheTileVertices(const int bytesPerVertex)
+{
+   //half of L2 leaves room for the other stream and whatever the other
+   //hyperthread keeps there, rounded to whole vector registers
+   static const long l2 = cacheSize(2);
+   long vertices = l2 / 2 / bytesPerVertex;
+   vertices -= vertices % 64;
+   return vertices < 1024 ? 1024 : vertices > (1 << 24) ? (1 << 24) : (int)vertices;
+}
+
+int detectSimdLevel()
+{
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f")) {
+      return SIMD_AVX512;
+   }
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return SIMD_AVX2;
+   }
+   return SIMD_BASELINE;
+}
+
+//sum of 1 / dist^2 between one magnet vertex and every object vertex, the same
+//loop is compiled once per instruction set and precision by the wrappers below
+template <typename T>
+static inline __attribute__((always_inline)) double inverseSquareRow(
+  const T mx, const T my, const T mz,
+  T const* __restrict ox, T const* __restrict oy, T const* __restrict oz,
+  const int numObj
+)
+{
+   T acc = 0;
+   #pragma omp simd reduction (+: acc)
+   for (int j=0; j < numObj; j++) {
+      T dx = mx - ox[j];
+      T dy = my - oy[j];
+      T dz = mz - oz[j];
+      acc += T(1) / (dx*dx + dy*dy + dz*dz);
+   }
+   return acc;
+}
+
+template <typename T>
+static double inverseSquareRowBaseline(T mx, T my, T mz, 
+   T const* ox, T const* oy, T const* oz, int numObj)
+{
+   return inverseSquareRow(mx, my, mz, ox, oy, oz, numObj);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma")))
+static double inverseSquareRowAvx2(T mx, T my, T mz, 
+   T const* ox, T const* oy, T const* oz, int numObj)
+{
+   return inverseSquareRow(mx, my, mz, ox, oy, oz, numObj);
+}
+
+//AVX-512 has a 14 bit reciprocal estimate for doubles, two Newton steps take it
+//to full precision and replace the long latency divide of the other paths
+__attribute__((target("avx512f,fma")))
+static double inverseSquareRowAvx512(double mx, double my, double mz, 
+   double const* ox, double const* oy, double const* oz, int numObj)
+{
+   __m512d vx = _mm512_set1_pd(mx);
+   __m512d vy = _mm512_set1_pd(my);
+   __m512d vz = _mm512_set1_pd(mz);
+   __m512d two = _mm512_set1_pd(2.0);
+   __m512d acc = _mm512_setzero_pd();
+   
+   for (int j=0; j < numObj; j += 8) {
+      //the tail is loaded with a mask, masked lanes get a zero reciprocal
+      __mmask8 mask = numObj - j >= 8 ? 0xFF : (__mmask8)((1u << (numObj - j)) - 1);
+      __m512d dx = _mm512_sub_pd(vx, _mm512_maskz_loadu_pd(mask, ox + j));
+      __m512d dy = _mm512_sub_pd(vy, _mm512_maskz_loadu_pd(mask, oy + j));
+      __m512d dz = _mm512_sub_pd(vz, _mm512_maskz_loadu_pd(mask, oz + j));
+      __m512d d2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+      __m512d r = _mm512_maskz_rcp14_pd(mask, d2);
+      r = _mm512_mul_pd(r, _mm512_fnmadd_pd(d2, r, two));
+      r = _mm512_mul_pd(r, _mm512_fnmadd_pd(d2, r, two));
+      acc = _mm512_add_pd(acc, r);
+   }
+   
+   double lanes[8];
+   _mm512_storeu_pd(lanes, acc);
+   return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+//single precision version, sixteen lanes and one Newton step is enough for a float
+__attribute__((target("avx512f,fma")))
+static double inverseSquareRowAvx512(float mx, float my, float mz, 
+   float const* ox, float const* oy, float const* oz, int numObj)
+{
+   __m512 vx = _mm512_set1_ps(mx);
+   __m512 vy = _mm512_set1_ps(my);
+   __m512 vz = _mm512_set1_ps(mz);
+   __m512 two = _mm512_set1_ps(2.0f);
+   __m512 acc = _mm512_setzero_ps();
+   
+   for (int j=0; j < numObj; j += 16) {
+      __mmask16 mask = numObj - j >= 16 ? 0xFFFF : (__mmask16)((1u << (numObj - j)) - 1);
+      __m512 dx = _mm512_sub_ps(vx, _mm512_maskz_loadu_ps(mask, ox + j));
+      __m512 dy = _mm512_sub_ps(vy, _mm512_maskz_loadu_ps(mask, oy + j));
+      __m512 dz = _mm512_sub_ps(vz, _mm512_maskz_loadu_ps(mask, oz + j));
+      __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+      __m512 r = _mm512_maskz_rcp14_ps(mask, d2);
+      r = _mm512_mul_ps(r, _mm512_fnmadd_ps(d2, r, two));
+      acc = _mm512_add_ps(acc, r);
+   }
+   
+   float lanes[16];
+   _mm512_storeu_ps(lanes, acc);
+   double sum = 0;
+   for (int k=0; k < 16; k++) {
+      sum += lanes[k];
+   }
+   return sum;
+}
+
+//inverseSquareRow over the object vertices closer than sqrt(radiusSq), for
+//the cell grid. Divides unconditionally and selects after, which vectorizes
+template <typename T>
+static inline __attribute__((always_inline)) double inverseSquareRowWithin(
+  const T mx, const T my, const T mz,
+  T const* __restrict ox, T const* __restrict oy, T const* __restrict oz,
+  const int numObj, const T radiusSq
+)
+{
+   T acc = 0;
+   #pragma omp simd reduction (+: acc)
+   for (int j=0; j < numObj; j++) {
+      T dx = mx - ox[j];
+      T dy = my - oy[j];
+      T dz = mz - oz[j];
+      T d2 = dx*dx + dy*dy + dz*dz;
+      T term = T(1) / d2;
+      acc += d2 < radiusSq ? term : T(0);
+   }
+   return acc;
+}
+
+template <typename T>
+static double inverseSquareRowWithinBaseline(T mx, T my, T mz, 
+   T const* ox, T const* oy, T const* oz, int numObj, T radiusSq)
+{
+   return inverseSquareRowWithin(mx, my, mz, ox, oy, oz, numObj, radiusSq);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma")))
+static double inverseSquareRowWithinAvx2(T mx, T my, T mz, 
+   T const* ox, T const* oy, T const* oz, int numObj, T radiusSq)
+{
+   return inverseSquareRowWithin(mx, my, mz, ox, oy, oz, numObj, radiusSq);
+}
+
+//inverseSquareRowAvx512 with the lanes outside the radius masked off the reciprocal
+__attribute__((target("avx512f,fma")))
+static double inverseSquareRowWithinAvx512(double mx, double my, double mz, 
+   double const* ox, double const* oy, double const* oz, int numObj, double radiusSq)
+{
+   __m512d vx = _mm512_set1_pd(mx);
+   __m512d vy = _mm512_set1_pd(my);
+   __m512d vz = _mm512_set1_pd(mz);
+   __m512d r2 = _mm512_set1_pd(radiusSq);
+   __m512d two = _mm512_set1_pd(2.0);
+   __m512d acc = _mm512_setzero_pd();
+   
+   for (int j=0; j < numObj; j += 8) {
+      __mmask8 mask = numObj - j >= 8 ? 0xFF : (__mmask8)((1u << (numObj - j)) - 1);
+      __m512d dx = _mm512_sub_pd(vx, _mm512_maskz_loadu_pd(mask, ox + j));
+      __m512d dy = _mm512_sub_pd(vy, _mm512_maskz_loadu_pd(mask, oy + j));
+      __m512d dz = _mm512_sub_pd(vz, _mm512_maskz_loadu_pd(mask, oz + j));
+      __m512d d2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+      mask = _mm512_mask_cmp_pd_mask(mask, d2, r2, _CMP_LT_OQ);
+      __m512d r = _mm512_maskz_rcp14_pd(mask, d2);
+      r = _mm512_mul_pd(r, _mm512_fnmadd_pd(d2, r, two));
+      r = _mm512_mul_pd(r, _mm512_fnmadd_pd(d2, r, two));
+      acc = _mm512_add_pd(acc, r);
+   }
+   
+   double lanes[8];
+   _mm512_storeu_pd(lanes, acc);
+   return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+__attribute__((target("avx512f,fma")))
+static double inverseSquareRowWithinAvx512(float mx, float my, float mz, 
+   float const* ox, float const* oy, float const* oz, int numObj, float radiusSq)
+{
+   __m512 vx = _mm512_set1_ps(mx);
+   __m512 vy = _mm512_set1_ps(my);
+   __m512 vz = _mm512_set1_ps(mz);
+   __m512 r2 = _mm512_set1_ps(radiusSq);
+   __m512 two = _mm512_set1_ps(2.0f);
+   __m512 acc = _mm512_setzero_ps();
+   
+   for (int j=0; j < numObj; j += 16) {
+      __mmask16 mask = numObj - j >= 16 ? 0xFFFF : (__mmask16)((1u << (numObj - j)) - 1);
+      __m512 dx = _mm512_sub_ps(vx, _mm512_maskz_loadu_ps(mask, ox + j));
+      __m512 dy = _mm512_sub_ps(vy, _mm512_maskz_loadu_ps(mask, oy + j));
+      __m512 dz = _mm512_sub_ps(vz, _mm512_maskz_loadu_ps(mask, oz + j));
+      __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+      mask = _mm512_mask_cmp_ps_mask(mask, d2, r2, _CMP_LT_OQ);
+      __m512 r = _mm512_maskz_rcp14_ps(mask, d2);
+      r = _mm512_mul_ps(r, _mm512_fnmadd_ps(d2, r, two));
+      acc = _mm512_add_ps(acc, r);
+   }
+   
+   float lanes[16];
+   _mm512_storeu_ps(lanes, acc);
+   double sum = 0;
+   for (int k=0; k < 16; k++) {
+      sum += lanes[k];
+   }
+   return sum;
+}
+
+int magnetBlocks(const int numMag)
+{
+   const int blocks = (numMag + MAGNET_BLOCK_ROWS - 1) / MAGNET_BLOCK_ROWS;
+   return blocks < MAGNET_BLOCKS ? blocks : MAGNET_BLOCKS;
+}
+
+template <typename T>
+double inverseSquareSum(
+  const int numMag,
+  const int numObj,
+  T const* mag, 
+  T const* obj,
+  const double* polarityValues,
+  const int simdLevel
+)
+{
+   int objStart[2] = {0, numObj};
+   double sum;
+   inverseSquareSums(numMag, 1, objStart, mag, obj, polarityValues, simdLevel, &sum);
+   return sum;
+}
+
+template <typename T>
+void inverseSquareSums(
+  const int numMag,
+  const int numObjects,
+  const int* objStart,
+  T const* mag, 
+  T const* obj,
+  const double* polarityValues,
+  const int simdLevel,
+  double* sums,
+  int tileVertices
+)
+{
+   const int total = objStart[numObjects];
+   double (*row)(T, T, T, T const*, T const*, T const*, int) = inverseSquareKernels<T>(simdLevel).row;
+   for (int k=0; k < numObjects; k++) {
+      sums[k] = 0;
+   }
+   if (numMag == 0 || total == 0) {
+      return;
+   }
+   if (tileVertices < 0) {
+      tileVertices = cacheTileVertices(3 * sizeof(T));
+   }
+   const int tile = tileVertices > 0 && tileVertices < total ? tileVertices : total;
+
+   //the threads take large blocks of magnet rows and run every row of a block
+   //over one cache sized tile of the object before moving to the next, so
+   //the object comes from DRAM once per block instead of once per row
+   const int numBlocks = magnetBlocks(numMag);
+   
+   //every magnet row covers all objects, so the objects share one parallel
+   //loop. Each block sums into its own partials, which are added in block
+   //order afterwards, so neither the schedule nor the thread count changes
+   //the result
+   double* partials = (double *)malloc(sizeof(double) * numBlocks * numObjects);
+   #pragma omp parallel for schedule(dynamic, 1)
+   for (int b=0; b < numBlocks; b++) {
+      const int first = (int)((long)numMag * b / numBlocks);
+      const int last = (int)((long)numMag * (b + 1) / numBlocks);
+      double* blockSums = partials + (long)b * numObjects;
+      for (int k=0; k < numObjects; k++) {
+         blockSums[k] = 0;
+      }
+      int k0 = 0;
+      for (int lo=0; lo < total; lo += tile) {
+         const int hi = lo + tile < total ? lo + tile : total;
+         while (objStart[k0+1] <= lo) {
+            k0++;
+         }
+         for (int i=first; i < last; i++) {
+            for (int k=k0; k < numObjects && objStart[k] < hi; k++) {
+               const int start = objStart[k] > lo ? objStart[k] : lo;
+               const int end = objStart[k+1] < hi ? objStart[k+1] : hi;
+               if (end <= start) {
+                  continue;
+               }
+               //value of magnetic influence exponentially decreases with distance,
+               blockSums[k] += row(mag[i], mag[numMag+i], mag[2*numMag+i], 
+                  obj + start, obj + total + start, obj + 2*total + start, end - start) / polarityValues[i];
+            }
+         }
+      }
+   }
+   for (int b=0; b < numBlocks; b++) {
+      for (int k=0; k < numObjects; k++) {
+         sums[k] += partials[(long)b * numObjects + k];
+      }
+   }
+   free(partials);
+}
+
+template double inverseSquareSum<float>(int, int, float const*, float const*, const double*, int);
+template double inverseSquareSum<double>(int, int, double const*, double const*, const double*, int);
+template void inverseSquareSums<float>(int, int, const int*, float const*, float const*, const double*, 
+   int, double*, int);
+template void inverseSquareSums<double>(int, int, const int*, double const*, double const*, const double*, 
+   int, double*, int);
+
+float* toSinglePrecision(const double* values, int count, ScratchArena* scratch)
+{
+   float* result = scratch ? scratch->allocate<float>(count) : (float *)malloc(sizeof(float) * count);
+   #pragma omp parallel for
+   for (int k=0; k < count; k++) {
+      result[k] = (float)values[k];
+   }
+   return result;
+}
+
+void magnetPolarity(const int numMag, double const* mag, double* polarityValues)
+{
+   magnetPolarityFromZ(numMag, mag + 2*numMag, polarityValues);
+}
+
+void magnetPolarityFromZ(const int numMag, double const* z, double* polarityValues)
+{
+   double min = DBL_MAX, max = -DBL_MAX;
+   
+   //finds min and max z-coordinate values to determine middle point (choice of z-axis was ours)
+   #pragma omp parallel for simd reduction (min: min) reduction (max: max)
+   for (int i = 0; i < numMag; i++) {
+      min = z[i] < min ? z[i] : min;
+      max = z[i] > max ? z[i] : max;
+   }
+   
+   double middle = (min + max) / 2;
+   
+   //assigns polarity based on middle point of mesh
+   #pragma omp parallel for simd
+   for (int i = 0; i < numMag; i++) {
+      polarityValues[i] = z[i] > middle ? max / z[i] : -min / z[i];
+   }
+}
+
+void magnetForce(
+  const int numMag,
+  const int numObj,
+  const double tesla,
+  double const* mag, 
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const double openingAngle,
+  const CellGrid& magGrid,
+  const double influenceRadius,
+  double* obj,
+  const double* polarityValues,
+  const int objectPolarity,
+  bool singlePrecision,
+  const int backend,
+  ScratchArena* scratch,
+  int maxSubsteps
+) 
+{
+   int objStart[2] = {0, numObj};
+   magnetForceBatch(numMag, 1, objStart, tesla, mag, magTree, magOctree, openingAngle, magGrid, 
+      influenceRadius, obj, polarityValues, objectPolarity, singlePrecision, backend, scratch, maxSubsteps);
+}
+
+//bounding box of numObj planar points
+static void pointBounds(const int numObj, double const* obj, double* lo, double* hi)
+{
+   double minX = DBL_MAX, minY = DBL_MAX, minZ = DBL_MAX;
+   double maxX = -DBL_MAX, maxY = -DBL_MAX, maxZ = -DBL_MAX;
+   #pragma omp parallel for simd reduction (min: minX, minY, minZ) reduction (max: maxX, maxY, maxZ)
+   for (int j=0; j < numObj; j++) {
+      minX = obj[j] < minX ? obj[j] : minX;
+      maxX = obj[j] > maxX ? obj[j] : maxX;
+      minY = obj[numObj+j] < minY ? obj[numObj+j] : minY;
+      maxY = obj[numObj+j] > maxY ? obj[numObj+j] : maxY;
+      minZ = obj[2*numObj+j] < minZ ? obj[2*numObj+j] : minZ;
+      maxZ = obj[2*numObj+j] > maxZ ? obj[2*numObj+j] : maxZ;
+   }
+   lo[0] = minX; lo[1] = minY; lo[2] = minZ;
+   hi[0] = maxX; hi[1] = maxY; hi[2] = maxZ;
+}
+
+//bounding box of the vertices a up to b of a planar buffer of total vertices
+static void runBounds(const int a, const int b, double const* obj, const int total, double* lo, double* hi)
+{
+   for (int d=0; d < 3; d++) {
+      lo[d] = DBL_MAX;
+      hi[d] = -DBL_MAX;
+   }
+   for (int j=a; j < b; j++) {
+      for (int d=0; d < 3; d++) {
+         double v = obj[d*total+j];
+         lo[d] = v < lo[d] ? v : lo[d];
+         hi[d] = v > hi[d] ? v : hi[d];
+      }
+   }
+}
+
+//cuts every object into runs of length vertices, the last run of an object
+//may be shorter. Returns the number of runs, runStart gets one more entry
+static int cutRuns(const int numObjects, const int* objStart, const int length, int* runStart, int* runObject)
+{
+   int numRuns = 0;
+   for (int k=0; k < numObjects; k++) {
+      for (int j=objStart[k]; j < objStart[k + 1]; j += length) {
+         runStart[numRuns] = j;
+         runObject[numRuns++] = k;
+      }
+   }
+   runStart[numRuns] = objStart[numObjects];
+   return numRuns;
+}
+
+bool cutoffSums(
+  const CellGrid& magGrid,
+  const int numObjects,
+  const int* objStart,
+  double const* obj,
+  double* sums,
+  ScratchArena* scratch
+)
+{
+   const int total = objStart[numObjects];
+   double lo[3], hi[3];
+   pointBounds(total, obj, lo, hi);
+   if (total > 0 && magGrid.covers(lo, hi)) {
+      return false;
+   }
+   if (total == 0 || magGrid.size() == 0) {
+      for (int k=0; k < numObjects; k++) {
+         sums[k] = 0;
+      }
+      return true;
+   }
+
+   //the vertices of every object are ordered along a Morton curve through
+   //the object's bounding box and cut into short runs, so each run has a
+   //tight box and the magnet points too far from it are skipped at once
+   std::pair<unsigned long long, int>* keys = scratch ? scratch->allocate<std::pair<unsigned long long, int> >(total)
+      : (std::pair<unsigned long long, int> *)malloc(sizeof(std::pair<unsigned long long, int>) * total);
+   double* sorted = scratch ? scratch->allocate<double>(total * 3) : (double *)malloc(sizeof(double) * total * 3);
+   const int maxRuns = total / CUTOFF_RUN + numObjects + 1;
+   int* runStart = scratch ? scratch->allocate<int>(maxRuns) : (int *)malloc(sizeof(int) * maxRuns);
+   int* runObject = scratch ? scratch->allocate<int>(maxRuns) : (int *)malloc(sizeof(int) * maxRuns);
+   for (int k=0; k < numObjects; k++) {
+      #pragma omp parallel for
+      for (int j=objStart[k]; j < objStart[k + 1]; j++) {
+         unsigned long long code = 0;
+         for (int d=0; d < 3; d++) {
+            double size = hi[d] - lo[d];
+            unsigned long long cell = size > 0 ? (unsigned long long)((obj[d*total+j] - lo[d]) / size * 1023.0) : 0;
+            for (int bit=0; bit < 10; bit++) {
+               code |= ((cell >> bit) & 1) << (3 * bit + d);
+            }
+         }
+         keys[j] = std::make_pair(((unsigned long long)k << 32) | code, j);
+      }
+   }
+   std::sort(keys, keys + total);
+   #pragma omp parallel for
+   for (int j=0; j < total; j++) {
+      sorted[j] = obj[keys[j].second];
+      sorted[total+j] = obj[total+keys[j].second];
+      sorted[2*total+j] = obj[2*total+keys[j].second];
+   }
+   int numRuns = cutRuns(numObjects, objStart, CUTOFF_RUN, runStart, runObject);
+
+   //a sample of the runs estimates the share of the pairs the grid visits.
+   //When most are, short runs skip too little to pay for their calls, and
+   //the objects are cut into runs as long as the exact kernel's tiles
+   double visited = 0, sampled = 0;
+   for (int r=0; r < numRuns; r += CUTOFF_SAMPLE) {
+      double runLo[3], runHi[3];
+      runBounds(runStart[r], runStart[r + 1], sorted, total, runLo, runHi);
+      visited += (double)magGrid.pointsNear(runLo, runHi) * (runStart[r + 1] - runStart[r]);
+      sampled += (double)magGrid.size() * (runStart[r + 1] - runStart[r]);
+   }
+   if (visited > CUTOFF_DENSE_SHARE * sampled) {
+      int length = total / MAGNET_BLOCKS;
+      length = length < cacheTileVertices(3 * sizeof(double)) ? length : cacheTileVertices(3 * sizeof(double));
+      numRuns = cutRuns(numObjects, objStart, length > CUTOFF_RUN ? length : CUTOFF_RUN, runStart, runObject);
+   }
+
+   //every run meets the magnet cells around it. Each run keeps its own sum
+   //and they are added in run order, so the threads sharing the runs do not
+   //change the result
+   static const CellGrid::RowWithin rowWithin = inverseSquareKernels<double>(detectSimdLevel()).rowWithin;
+   double* runSums = scratch ? scratch->allocate<double>(maxRuns) : (double *)malloc(sizeof(double) * maxRuns);
+   #pragma omp parallel for schedule(dynamic, 4)
+   for (int r=0; r < numRuns; r++) {
+      const int a = runStart[r];
+      const int b = runStart[r + 1];
+      double runLo[3], runHi[3];
+      runBounds(a, b, sorted, total, runLo, runHi);
+      runSums[r] = magGrid.inverseSquareBox(runLo, runHi, sorted + a, sorted + total + a, 
+         sorted + 2*total + a, b - a, rowWithin);
+   }
+   for (int k=0; k < numObjects; k++) {
+      sums[k] = 0;
+   }
+   for (int r=0; r < numRuns; r++) {
+      sums[runObject[r]] += runSums[r];
+   }
+
+   if (!scratch) {
+      free(keys);
+      free(sorted);
+      free(runStart);
+      free(runObject);
+      free(runSums);
+   }
+   return true;
+}
+
+//Barnes-Hut counterpart of inverseSquareSums. Every vertex keeps its own
+//term and the terms are added in vertex order, so the sums do not depend on
+//which thread walked which vertex
+static void octreeSums(const Octree& magOctree, const int numObjects, const int* objStart, double const* obj,
+   const double openingAngle, double* sums, ScratchArena* scratch)
+{
+   const int total = objStart[numObjects];
+   double* terms = scratch ? scratch->allocate<double>(total) : (double *)malloc(sizeof(double) * total);
+   #pragma omp parallel for schedule(dynamic, 64)
+   for (int j=0; j < total; j++) {
+      double q[3] = {obj[j], obj[total+j], obj[2*total+j]};
+      terms[j] = magOctree.inverseSquare(q, openingAngle);
+   }
+   for (int k=0; k < numObjects; k++) {
+      sums[k] = 0;
+      for (int j=objStart[k]; j < objStart[k + 1]; j++) {
+         sums[k] += terms[j];
+      }
+   }
+   if (!scratch) {
+      free(terms);
+   }
+}
+
+//influence sums and closest pairs of objects laid out like closestPairs
+//expects. The sums come from magGrid when it is given or else the octree
+//when approximate, otherwise from the backend, in single precision against
+//magSingle when it is not NULL. A grid whose radius covers every pair gives
+//the exact sum, so the backend runs instead
+static void forceTerms(
+  const int numMag,
+  const int numObjects,
+  const int* objStart,
+  double const* mag,
+  float const* magSingle,
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const CellGrid* magGrid,
+  const double openingAngle,
+  bool approximate,
+  double const* obj,
+  const double* polarityValues,
+  const int backend,
+  ScratchArena* scratch,
+  double* sums,
+  double* closest,
+  int* closMag,
+  int* closObj
+)
+{
+   const int total = objStart[numObjects];
+   if (magGrid && cutoffSums(*magGrid, numObjects, objStart, obj, sums, scratch)) {
+      //the pairs beyond the radius were skipped
+   } else if (approximate && !magGrid) {
+      octreeSums(magOctree, numObjects, objStart, obj, openingAngle, sums, scratch);
+   } else {
+      const ComputeBackend* compute = computeBackendOrDefault(backend);
+      if (magSingle) {
+         //the copy is O(numObj), the sum it feeds is O(numMag * numObj)
+         float* objSingle = toSinglePrecision(obj, total * 3, scratch);
+         compute->inverseSquareSums(numMag, numObjects, objStart, magSingle, objSingle, polarityValues, sums);
+         if (!scratch) {
+            free(objSingle);
+         }
+      } else {
+         compute->inverseSquareSums(numMag, numObjects, objStart, mag, obj, polarityValues, sums);
+      }
+   }
+   
+   //the closest pair is a tree search, it does not go through the backend
+   if (magTree.size() > 0) {
+      closestPairs(magTree, numObjects, objStart, obj, closMag, closObj, closest);
+   } else {
+      for (int k=0; k < numObjects; k++) {
+         closMag[k] = closObj[k] = 0;
+      }
+   }
+}
+
+void magnetForceBatch(
+  const int numMag,
+  const int numObjects,
+  const int* objStart,
+  const double tesla,
+  double const* mag, 
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const double openingAngle,
+  const CellGrid& magGrid,
+  const double influenceRadius,
+  double* obj,
+  const double* polarityValues,
+  const int objectPolarity,
+  bool singlePrecision,
+  const int backend,
+  ScratchArena* scratch,
+  int maxSubsteps
+) 
+{  
+   const int total = objStart[numObjects];
+   const int steps = maxSubsteps > 1 ? maxSubsteps : 1;
+   
+   //per object sums, closest distances and what is left of each object's
+   //step, then the closest pairs, the objects still stepping and their
+   //ranges once packed
+   double* perObject = scratch ? scratch->allocate<double>(numObjects * 3)
+      : (double *)malloc(sizeof(double) * numObjects * 3);
+   int* perObjectIndex = scratch ? scratch->allocate<int>(numObjects * 4 + 1)
+      : (int *)malloc(sizeof(int) * (numObjects * 4 + 1));
+   double* sums = perObject;
+   double* closest = perObject + numObjects;
+   double* remaining = perObject + 2 * numObjects;
+   int* closMag = perObjectIndex;
+   int* closObj = perObjectIndex + numObjects;
+   int* active = perObjectIndex + 2 * numObjects;
+   int* packedStart = perObjectIndex + 3 * numObjects;
+   
+   //determines if the influence represents attraction or repulsion
+   double magFactor = objectPolarity ? tesla : -tesla;
+   
+   //the cutoff radius takes precedence, it skips the far pairs the octree would approximate
+   const bool cutoff = influenceRadius > 0 && magGrid.size() == numMag && magGrid.influenceRadius() == influenceRadius;
+   const bool approximate = cutoff || (openingAngle > 0 && magOctree.size() == numMag);
+   
+   //the magnet does not move during the step, its single precision copy
+   //serves every sub-step
+   float* magSingle = singlePrecision && !approximate ? toSinglePrecision(mag, numMag * 3, scratch) : NULL;
+   
+   for (int k=0; k < numObjects; k++) {
+      remaining[k] = 1;
+      active[k] = k;
+   }
+   int numActive = numObjects;
+   
+   for (int step=0; step < steps && numActive > 0; step++) {
+      //objects that finished their step drop out, the others are packed into
+      //a buffer of their own so the sums only cover them
+      const double* stepObj = obj;
+      const int* stepStart = objStart;
+      double* packed = NULL;
+      if (numActive < numObjects) {
+         packedStart[0] = 0;
+         for (int a=0; a < numActive; a++) {
+            packedStart[a + 1] = packedStart[a] + objStart[active[a] + 1] - objStart[active[a]];
+         }
+         const int packedTotal = packedStart[numActive];
+         packed = scratch ? scratch->allocate<double>(packedTotal * 3)
+            : (double *)malloc(sizeof(double) * packedTotal * 3);
+         for (int a=0; a < numActive; a++) {
+            const int start = objStart[active[a]];
+            const int n = packedStart[a + 1] - packedStart[a];
+            for (int c=0; c < 3; c++) {
+               memcpy(packed + c * packedTotal + packedStart[a], obj + c * total + start, sizeof(double) * n);
+            }
+         }
+         stepObj = packed;
+         stepStart = packedStart;
+      }
+      const int stepTotal = stepStart[numActive];
+      
+      forceTerms(numMag, numActive, stepStart, mag, magSingle, magTree, magOctree, cutoff ? &magGrid : NULL,
+         openingAngle, approximate, stepObj, polarityValues, backend, scratch, sums, closest, closMag, closObj);
+      
+      int stillActive = 0;
+      for (int a=0; a < numActive; a++) {
+         const int k = active[a];
+         const int start = objStart[k];
+         const int numObj = objStart[k + 1] - start;
+         if (numObj == 0) {
+            continue;
+         }
+         double vec[3];
+         
+         //compute average magnetic influence per vertex
+         double avg = magFactor * sums[a] * (1.0 / numObj);
+         
+         //vector between the two closest points
+         int j = stepStart[a] + closObj[a];
+         vec[0] = stepObj[j] - mag[closMag[a]];
+         vec[1] = stepObj[stepTotal+j] - mag[numMag+closMag[a]];
+         vec[2] = stepObj[2*stepTotal+j] - mag[2*numMag+closMag[a]];
+         
+         double norm = sqrt(vec[0]*vec[0] + vec[1]*vec[1] + vec[2]*vec[2]);
+         
+         //an object whose step would cover more than SUBSTEP_GAP of the gap to
+         //the magnet only takes that much and measures again. Far objects
+         //finish in one step. An object pushed away spreads what is left over
+         //the remaining sub-steps and the last one finishes it, while an
+         //object pulled in never closes more than SUBSTEP_GAP of its gap at
+         //once and leaves the rest when the sub-steps run out
+         double dt = remaining[k];
+         if (steps > 1 && fabs(avg) * dt > SUBSTEP_GAP * norm) {
+            if (avg < 0) {
+               dt = SUBSTEP_GAP * norm / fabs(avg);
+            } else if (step + 1 < steps) {
+               double least = remaining[k] / (steps - step);
+               dt = SUBSTEP_GAP * norm / fabs(avg);
+               dt = dt > least ? dt : least;
+            }
+         }
+         double move = avg * dt;
+         
+         //object can only be attracted or repelled a distance less than or equal
+         //to the gap between the closest points, attraction stops at the magnet
+         move = fabs(move) >= norm ? copysign(norm, move) : move;
+         for (int c=0; c < 3; c++) {
+            vec[c] = norm > 0 ? (vec[c] / norm) * move : 0;
+         }
+         
+         //updates positions of vertices
+         if (tesla != 0) {
+            double* x = obj + start;
+            double* y = obj + total + start;
+            double* z = obj + 2*total + start;
+            #pragma omp simd
+            for (int i = 0; i < numObj; i++) {
+               x[i] = x[i] + vec[0];
+               y[i] = y[i] + vec[1];
+               z[i] = z[i] + vec[2];
+            }
+         }
+         
+         remaining[k] -= dt;
+         if (remaining[k] > 0) {
+            active[stillActive++] = k;
+         }
+      }
+      numActive = stillActive;
+      
+      if (packed && !scratch) {
+         free(packed);
+      }
+   }
+   
+   if (magSingle && !scratch) {
+      free(magSingle);
+   }
+   if (!scratch) {
+      free(perObject);
+      free(perObjectIndex);
+   }
+}
+
+//field at one object vertex from every magnet vertex, compiled once per
+//instruction set like inverseSquareRow. The loop runs over the magnet so the
+//three components vectorize as plain reductions
+template <typename T>
+static inline __attribute__((always_inline)) void inverseSquareColumn(
+  const T ox, const T oy, const T oz,
+  T const* __restrict mx, T const* __restrict my, T const* __restrict mz,
+  T const* __restrict weights, const int numMag, double* field
+)
+{
+   T fx = 0, fy = 0, fz = 0;
+   #pragma omp simd reduction (+: fx, fy, fz)
+   for (int i=0; i < numMag; i++) {
+      T dx = ox - mx[i];
+      T dy = oy - my[i];
+      T dz = oz - mz[i];
+      T d2 = dx*dx + dy*dy + dz*dz;
+      T s = weights[i] / (d2 * std::sqrt(d2));
+      fx += s * dx;
+      fy += s * dy;
+      fz += s * dz;
+   }
+   field[0] = fx;
+   field[1] = fy;
+   field[2] = fz;
+}
+
+template <typename T>
+static void inverseSquareColumnBaseline(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, double* field)
+{
+   inverseSquareColumn(ox, oy, oz, mx, my, mz, weights, numMag, field);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma")))
+static void inverseSquareColumnAvx2(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, double* field)
+{
+   inverseSquareColumn(ox, oy, oz, mx, my, mz, weights, numMag, field);
+}
+
+template <typename T>
+__attribute__((target("avx512f,fma")))
+static void inverseSquareColumnAvx512(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, double* field)
+{
+   inverseSquareColumn(ox, oy, oz, mx, my, mz, weights, numMag, field);
+}
+
+//inverseSquareColumn over the magnet vertices closer than sqrt(radiusSq)
+template <typename T>
+static inline __attribute__((always_inline)) void inverseSquareColumnWithin(
+  const T ox, const T oy, const T oz,
+  T const* __restrict mx, T const* __restrict my, T const* __restrict mz,
+  T const* __restrict weights, const int numMag, const T radiusSq, double* field
+)
+{
+   T fx = 0, fy = 0, fz = 0;
+   #pragma omp simd reduction (+: fx, fy, fz)
+   for (int i=0; i < numMag; i++) {
+      T dx = ox - mx[i];
+      T dy = oy - my[i];
+      T dz = oz - mz[i];
+      T d2 = dx*dx + dy*dy + dz*dz;
+      T s = weights[i] / (d2 * std::sqrt(d2));
+      s = d2 < radiusSq ? s : T(0);
+      fx += s * dx;
+      fy += s * dy;
+      fz += s * dz;
+   }
+   field[0] = fx;
+   field[1] = fy;
+   field[2] = fz;
+}
+
+template <typename T>
+static void inverseSquareColumnWithinBaseline(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, T radiusSq, double* field)
+{
+   inverseSquareColumnWithin(ox, oy, oz, mx, my, mz, weights, numMag, radiusSq, field);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma")))
+static void inverseSquareColumnWithinAvx2(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, T radiusSq, double* field)
+{
+   inverseSquareColumnWithin(ox, oy, oz, mx, my, mz, weights, numMag, radiusSq, field);
+}
+
+template <typename T>
+__attribute__((target("avx512f,fma")))
+static void inverseSquareColumnWithinAvx512(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, 
+   T const* weights, int numMag, T radiusSq, double* field)
+{
+   inverseSquareColumnWithin(ox, oy, oz, mx, my, mz, weights, numMag, radiusSq, field);
+}
+
+template <typename T>
+InverseSquareKernels<T> inverseSquareKernels(const int simdLevel)
+{
+   InverseSquareKernels<T> kernels;
+   kernels.row = inverseSquareRowBaseline<T>;
+   kernels.column = inverseSquareColumnBaseline<T>;
+   kernels.rowWithin = inverseSquareRowWithinBaseline<T>;
+   kernels.columnWithin = inverseSquareColumnWithinBaseline<T>;
+   if (simdLevel == SIMD_AVX512) {
+      kernels.row = inverseSquareRowAvx512;
+      kernels.column = inverseSquareColumnAvx512<T>;
+      kernels.rowWithin = inverseSquareRowWithinAvx512;
+      kernels.columnWithin = inverseSquareColumnWithinAvx512<T>;
+   } else if (simdLevel == SIMD_AVX2) {
+      kernels.row = inverseSquareRowAvx2<T>;
+      kernels.column = inverseSquareColumnAvx2<T>;
+      kernels.rowWithin = inverseSquareRowWithinAvx2<T>;
+      kernels.columnWithin = inverseSquareColumnWithinAvx2<T>;
+   }
+   return kernels;
+}
+
+template InverseSquareKernels<float> inverseSquareKernels<float>(int);
+template InverseSquareKernels<double> inverseSquareKernels<double>(int);
+
+template <typename T>
+void inverseSquareField(
+  const int numMag,
+  const int numObj,
+  T const* mag,
+  T const* obj,
+  T const* weights,
+  const int simdLevel,
+  double* field,
+  int tileVertices
+)
+{
+   void (*column)(T, T, T, T const*, T const*, T const*, T const*, int, double*) = 
+      inverseSquareKernels<T>(simdLevel).column;
+   if (tileVertices < 0) {
+      tileVertices = cacheTileVertices(4 * sizeof(T));
+   }
+   const int tile = tileVertices > 0 && tileVertices < numMag ? tileVertices : numMag;
+   
+   //a block of object vertices walks the magnet one cache sized tile at a
+   //time, so the magnet comes from DRAM once per block instead of once per vertex
+   #pragma omp parallel for schedule(dynamic, 1)
+   for (int b=0; b < numObj; b += FIELD_BLOCK) {
+      const int n = numObj - b < FIELD_BLOCK ? numObj - b : FIELD_BLOCK;
+      double f[3][FIELD_BLOCK];
+      for (int j=0; j < n; j++) {
+         f[0][j] = f[1][j] = f[2][j] = 0;
+      }
+      for (int m0=0; m0 < numMag; m0 += tile) {
+         const int len = numMag - m0 < tile ? numMag - m0 : tile;
+         for (int j=0; j < n; j++) {
+            double c[3];
+            column(obj[b+j], obj[numObj+b+j], obj[2*numObj+b+j], mag + m0, mag + numMag + m0, 
+               mag + 2*numMag + m0, weights + m0, len, c);
+            f[0][j] += c[0];
+            f[1][j] += c[1];
+            f[2][j] += c[2];
+         }
+      }
+      for (int j=0; j < n; j++) {
+         field[b+j] = f[0][j];
+         field[numObj+b+j] = f[1][j];
+         field[2*numObj+b+j] = f[2][j];
+      }
+   }
+}
+
+template void inverseSquareField<float>(int, int, float const*, float const*, float const*, int, double*, int);
+template void inverseSquareField<double>(int, int, double const*, double const*, double const*, int, double*, int);
+
+void magnetField(
+  const int numMag,
+  const int numObj,
+  const double tesla,
+  double const* mag, 
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const double openingAngle,
+  const CellGrid& magGrid,
+  const double influenceRadius,
+  double* obj,
+  const double* polarityValues,
+  const int objectPolarity,
+  bool singlePrecision,
+  const int backend,
+  ScratchArena* scratch
+)
+{
+   if (numObj == 0 || numMag == 0 || tesla == 0) {
+      return;
+   }
+   double* field = scratch ? scratch->allocate<double>(numObj * 3) 
+      : (double *)malloc(sizeof(double) * numObj * 3);
+   
+   bool cutoff = influenceRadius > 0 && magGrid.size() == numMag && magGrid.influenceRadius() == influenceRadius;
+   bool covered = false;
+   if (cutoff) {
+      //a radius that covers every pair skips none, the exact field is faster
+      double lo[3], hi[3];
+      pointBounds(numObj, obj, lo, hi);
+      covered = magGrid.covers(lo, hi);
+   }
+   if (cutoff && !covered) {
+      static const CellGrid::ColumnWithin columnWithin 
+         = inverseSquareKernels<double>(detectSimdLevel()).columnWithin;
+      #pragma omp parallel for schedule(dynamic, 64)
+      for (int j=0; j < numObj; j++) {
+         double q[3] = {obj[j], obj[numObj+j], obj[2*numObj+j]};
+         double f[3];
+         magGrid.inverseSquareField(q, columnWithin, f);
+         field[j] = f[0];
+         field[numObj+j] = f[1];
+         field[2*numObj+j] = f[2];
+      }
+   } else if (!covered && openingAngle > 0 && magOctree.size() == numMag) {
+      #pragma omp parallel for schedule(dynamic, 64)
+      for (int j=0; j < numObj; j++) {
+         double q[3] = {obj[j], obj[numObj+j], obj[2*numObj+j]};
+         double f[3];
+         magOctree.inverseSquareField(q, openingAngle, f);
+         field[j] = f[0];
+         field[numObj+j] = f[1];
+         field[2*numObj+j] = f[2];
+      }
+   } else {
+      const ComputeBackend* compute = computeBackendOrDefault(backend);
+      if (singlePrecision) {
+         float* magSingle = toSinglePrecision(mag, numMag * 3, scratch);
+         float* objSingle = toSinglePrecision(obj, numObj * 3, scratch);
+         float* weights = scratch ? scratch->allocate<float>(numMag) : (float *)malloc(sizeof(float) * numMag);
+         for (int i=0; i < numMag; i++) {
+            weights[i] = (float)(1.0 / polarityValues[i]);
+         }
+         compute->inverseSquareField(numMag, numObj, magSingle, objSingle, weights, field);
+         if (!scratch) {
+            free(magSingle);
+            free(objSingle);
+            free(weights);
+         }
+      } else {
+         double* weights = scratch ? scratch->allocate<double>(numMag) : (double *)malloc(sizeof(double) * numMag);
+         for (int i=0; i < numMag; i++) {
+            weights[i] = 1.0 / polarityValues[i];
+         }
+         compute->inverseSquareField(numMag, numObj, mag, obj, weights, field);
+         if (!scratch) {
+            free(weights);
+         }
+      }
+   }
+   
+   //same sign convention as magnetForce, a positive factor pushes away
+   double magFactor = objectPolarity ? tesla : -tesla;
+   
+   #pragma omp parallel for
+   for (int j=0; j < numObj; j++) {
+      double q[3] = {obj[j], obj[numObj+j], obj[2*numObj+j]};
+      double vec[3] = {magFactor * field[j], magFactor * field[numObj+j], magFactor * field[2*numObj+j]};
+      
+      //a vertex can not be moved further than it is from the magnet, so it is
+      //never pulled through it
+      if (magTree.size() > 0) {
+         double closest;
+         magTree.nearest(q, &closest);
+         double lengthSq = vec[0]*vec[0] + vec[1]*vec[1] + vec[2]*vec[2];
+         if (lengthSq > closest) {
+            double scale = sqrt(closest / lengthSq);
+            vec[0] *= scale;
+            vec[1] *= scale;
+            vec[2] *= scale;
+         }
+      }
+      
+      obj[j] = q[0] + vec[0];
+      obj[numObj+j] = q[1] + vec[1];
+      obj[2*numObj+j] = q[2] + vec[2];
+   }
+   
+   if (!scratch) {
+      free(field);
+   }
+}
+
+unsigned long long hashValues(const void* data, size_t bytes, unsigned long long seed)
+{
+   const unsigned long long prime = 0x9E3779B97F4A7C15ULL;
+   const unsigned char* p = (const unsigned char *)data;
+   
+   //four independent lanes so consecutive words do not wait on each other
+   unsigned long long lane[4] = {seed, seed ^ prime, seed + prime, ~seed};
+   size_t words = bytes / 8;
+   size_t k = 0;
+   for (; k + 4 <= words; k += 4) {
+      unsigned long long w[4];
+      memcpy(w, p + k * 8, 32);
+      for (int l = 0; l < 4; l++) {
+         lane[l] = (lane[l] ^ w[l]) * 0xFF51AFD7ED558CCDULL;
+         lane[l] ^= lane[l] >> 32;
+      }
+   }
+   
+   unsigned long long h = bytes * prime;
+   for (int l = 0; l < 4; l++) {
+      h = (h ^ lane[l]) * prime;
+      h ^= h >> 29;
+   }
+   for (; k < words; k++) {
+      unsigned long long w;
+      memcpy(&w, p + k * 8, 8);
+      h = (h ^ w) * prime;
+      h ^= h >> 29;
+   }
+   for (size_t b = words * 8; b < bytes; b++) {
+      h = (h ^ p[b]) * prime;
+   }
+   
+   h ^= h >> 33;
+   h *= 0xC4CEB9FE1A85EC53ULL;
+   h ^= h >> 33;
+   return h;
+}
+
+double pickRigidFrame(const int numPoints, double const* points, int* frame)
+{
+   const double* x = points;
+   const double* y = points + numPoints;
+   const double* z = points + 2 * numPoints;
+   frame[0] = frame[1] = frame[2] = 0;
+   
+   double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+   double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+   for (int i = 0; i < numPoints; i++) {
+      min[0] = x[i] < min[0] ? x[i] : min[0];
+      max[0] = x[i] > max[0] ? x[i] : max[0];
+      min[1] = y[i] < min[1] ? y[i] : min[1];
+      max[1] = y[i] > max[1] ? y[i] : max[1];
+      min[2] = z[i] < min[2] ? z[i] : min[2];
+      max[2] = z[i] > max[2] ? z[i] : max[2];
+   }
+   
+   //the point furthest from the first one, then the point furthest from the
+   //line through both, so the frame is as well conditioned as the mesh allows
+   double best = -1;
+   for (int i = 0; i < numPoints; i++) {
+      double dx = x[i] - x[0], dy = y[i] - y[0], dz = z[i] - z[0];
+      double d = dx*dx + dy*dy + dz*dz;
+      if (d > best) {
+         best = d;
+         frame[1] = i;
+      }
+   }
+   double axis[3] = {x[frame[1]] - x[0], y[frame[1]] - y[0], z[frame[1]] - z[0]};
+   best = -1;
+   for (int i = 0; i < numPoints; i++) {
+      double dx = x[i] - x[0], dy = y[i] - y[0], dz = z[i] - z[0];
+      double cx = dy*axis[2] - dz*axis[1];
+      double cy = dz*axis[0] - dx*axis[2];
+      double cz = dx*axis[1] - dy*axis[0];
+      double d = cx*cx + cy*cy + cz*cz;
+      if (d > best) {
+         best = d;
+         frame[2] = i;
+      }
+   }
+   
+   if (numPoints == 0) {
+      return 0;
+   }
+   return sqrt((max[0]-min[0])*(max[0]-min[0]) + (max[1]-min[1])*(max[1]-min[1])
+      + (max[2]-min[2])*(max[2]-min[2]));
+}
+
+//orthonormal basis (rows) spanned by three planar points, false if they are
+//too close to a line
+static bool frameBasis(const int numPoints, double const* points, const int* frame, double* basis)
+{
+   double p[3][3];
+   for (int k = 0; k < 3; k++) {
+      for (int a = 0; a < 3; a++) {
+         p[k][a] = points[a * numPoints + frame[k]];
+      }
+   }
+   double* e1 = basis;
+   double* e2 = basis + 3;
+   double* e3 = basis + 6;
+   double v[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+   for (int a = 0; a < 3; a++) {
+      e1[a] = p[1][a] - p[0][a];
+   }
+   double n1 = sqrt(e1[0]*e1[0] + e1[1]*e1[1] + e1[2]*e1[2]);
+   if (n1 == 0) {
+      return false;
+   }
+   for (int a = 0; a < 3; a++) {
+      e1[a] /= n1;
+   }
+   double along = v[0]*e1[0] + v[1]*e1[1] + v[2]*e1[2];
+   for (int a = 0; a < 3; a++) {
+      e2[a] = v[a] - along * e1[a];
+   }
+   double n2 = sqrt(e2[0]*e2[0] + e2[1]*e2[1] + e2[2]*e2[2]);
+   if (n2 <= 1e-6 * n1) {
+      return false;
+   }
+   for (int a = 0; a < 3; a++) {
+      e2[a] /= n2;
+   }
+   e3[0] = e1[1]*e2[2] - e1[2]*e2[1];
+   e3[1] = e1[2]*e2[0] - e1[0]*e2[2];
+   e3[2] = e1[0]*e2[1] - e1[1]*e2[0];
+   return true;
+}
+
+bool fitRigidMotion(
+  const int numPoints,
+  double const* reference,
+  double const* points,
+  const int* frame,
+  const double tolerance,
+  double* rotation,
+  double* translation
+)
+{
+   double from[9], to[9];
+   if (!frameBasis(numPoints, reference, frame, from) || !frameBasis(numPoints, points, frame, to)) {
+      return false;
+   }
+   
+   //rotation = to^T * from takes the reference basis onto the current one
+   for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+         rotation[r*3 + c] = to[r]*from[c] + to[3 + r]*from[3 + c] + to[6 + r]*from[6 + c];
+      }
+   }
+   for (int a = 0; a < 3; a++) {
+      const double* R = rotation + a*3;
+      translation[a] = points[a*numPoints + frame[0]] - (R[0]*reference[frame[0]] 
+         + R[1]*reference[numPoints + frame[0]] + R[2]*reference[2*numPoints + frame[0]]);
+   }
+   
+   //every point has to follow the motion, not only the three in the frame
+   const double toleranceSq = tolerance * tolerance;
+   int outside = 0;
+   #pragma omp parallel for reduction (+: outside)
+   for (int i = 0; i < numPoints; i++) {
+      double p[3] = {reference[i], reference[numPoints+i], reference[2*numPoints+i]};
+      double distSq = 0;
+      for (int a = 0; a < 3; a++) {
+         const double* R = rotation + a*3;
+         double d = R[0]*p[0] + R[1]*p[1] + R[2]*p[2] + translation[a] - points[a*numPoints + i];
+         distSq += d*d;
+      }
+      outside += distSq > toleranceSq;
+   }
+   return outside == 0;
+}
+
+void applyRigidMotion(
+  const int numPoints,
+  const double* rotation,
+  const double* translation,
+  bool inverse,
+  double* points
+)
+{
+   const double* R = rotation;
+   const double* t = translation;
+   double* x = points;
+   double* y = points + numPoints;
+   double* z = points + 2 * numPoints;
+   
+   if (inverse) {
+      //R is orthonormal, so its inverse is its transpose
+      #pragma omp parallel for
+      for (int i = 0; i < numPoints; i++) {
+         double p[3] = {x[i] - t[0], y[i] - t[1], z[i] - t[2]};
+         x[i] = R[0]*p[0] + R[3]*p[1] + R[6]*p[2];
+         y[i] = R[1]*p[0] + R[4]*p[1] + R[7]*p[2];
+         z[i] = R[2]*p[0] + R[5]*p[1] + R[8]*p[2];
+      }
+   } else {
+      #pragma omp parallel for
+      for (int i = 0; i < numPoints; i++) {
+         double p[3] = {x[i], y[i], z[i]};
+         x[i] = R[0]*p[0] + R[1]*p[1] + R[2]*p[2] + t[0];
+         y[i] = R[3]*p[0] + R[4]*p[1] + R[5]*p[2] + t[1];
+         z[i] = R[6]*p[0] + R[7]*p[1] + R[8]*p[2] + t[2];
+      }
+   }
+}
@@ -0,0 +1,282 @@
+//
+//  File: magnetcore.h
+//
+//  Description:
+//    Host independent magnet kernel shared by the Maya plug-in and the
+//    standalone tools. Nothing in here depends on the Maya SDK.
+//
+//    All point buffers are planar (structure of arrays): n x values, then
+//    n y values, then n z values, so the inner loops read unit-stride streams.
+//
+
+#ifndef MAGNETCORE_H
+#define MAGNETCORE_H
+
+#include <cfloat>
+#include <cmath>
+#include "omp.h"
+
+#include "cellgrid.h"
+#include "kdtree.h"
+#include "magnetbackend.h"
+#include "octree.h"
+#include "scratcharena.h"
+
+//instruction sets the influence kernel is compiled for, picked at runtime
+enum SimdLevel { SIMD_BASELINE, SIMD_AVX2, SIMD_AVX512 };
+
+const char* simdLevelName(int level);
+
+//widest instruction set the running cpu supports
+int detectSimdLevel();
+
+//size in bytes of the data cache of the given level (1, 2 or 3) of the
+//running cpu, a typical size when the system does not report it
+long cacheSize(const int level);
+
+//vertices of bytesPerVertex each that fill half of the L2 cache, the default
+//tile length of the exact kernels
+int cacheTileVertices(const int bytesPerVertex);
+
+//most blocks of magnet rows in inverseSquareSums and the fewest rows in one,
+//and object vertices per block in inverseSquareField. Every block reads the
+//other mesh once, so larger blocks mean less traffic but can leave threads
+//idle at the end
+enum { MAGNET_BLOCKS = 64, MAGNET_BLOCK_ROWS = 128, FIELD_BLOCK = 64 };
+
+//blocks of magnet rows inverseSquareSums splits numMag rows into. They only
+//depend on numMag, so the sums are added in the same order on any machine
+int magnetBlocks(const int numMag);
+
+//object vertices per run in cutoffSums. Shorter runs have tighter boxes and
+//skip more magnet points, longer ones keep the row kernel busy. One run in
+//CUTOFF_SAMPLE is used to estimate the share of the pairs the grid visits
+enum { CUTOFF_RUN = 64, CUTOFF_SAMPLE = 16 };
+
+//share of the pairs visited above which cutoffSums runs long rows, like the
+//exact kernel's, instead of skipping magnet points run by run
+const double CUTOFF_DENSE_SHARE = 0.5;
+
+//inner loops of the exact kernels compiled for one instruction set, the
+//backends spread the rows or columns over their threads
+template <typename T>
+struct InverseSquareKernels
+{
+   //sum of 1 / dist^2 between one magnet vertex and numObj object vertices
+   double (*row)(T mx, T my, T mz, T const* ox, T const* oy, T const* oz, int numObj);
+
+   //field weight * (object - magnet) / dist^3 at one object vertex from numMag magnet vertices
+   void (*column)(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, T const* weights, 
+      int numMag, double* field);
+
+   //row and column that skip the pairs at least sqrt(radiusSq) apart, for CellGrid
+   double (*rowWithin)(T mx, T my, T mz, T const* ox, T const* oy, T const* oz, int numObj, T radiusSq);
+   void (*columnWithin)(T ox, T oy, T oz, T const* mx, T const* my, T const* mz, T const* weights,
+      int numMag, T radiusSq, double* field);
+};
+
+template <typename T>
+InverseSquareKernels<T> inverseSquareKernels(const int simdLevel);
+
+//finds the closest magnet/object vertex pair with one tree query per object
+//vertex, ties go to the lowest (closMag, closObj) pair like a linear scan
+void closestPair(
+  const KdTree& magTree,
+  const int numObj,
+  double const* obj,
+  int* closMag,
+  int* closObj
+);
+
+//closestPair for several objects stored one after the other in one planar
+//buffer, object k owns vertices objStart[k] up to objStart[k + 1]. closObj is
+//relative to the start of each object, closest gets the squared distances
+void closestPairs(
+  const KdTree& magTree,
+  const int numObjects,
+  const int* objStart,
+  double const* obj,
+  int* closMag,
+  int* closObj,
+  double* closest
+);
+
+//sum of 1 / (polarity * dist^2) over every magnet/object vertex pair, T is
+//float or double and only sets the precision of the per pair arithmetic
+template <typename T>
+double inverseSquareSum(
+  const int numMag,
+  const int numObj,
+  T const* mag,
+  T const* obj,
+  const double* polarityValues,
+  const int simdLevel               //one of SimdLevel, see detectSimdLevel
+);
+
+//inverseSquareSum of every object in a buffer laid out like closestPairs,
+//one OpenMP loop over the magnet covers all of them. The object is walked
+//in tiles that stay in cache while a block of magnet rows runs over them
+template <typename T>
+void inverseSquareSums(
+  const int numMag,
+  const int numObjects,
+  const int* objStart,
+  T const* mag,
+  T const* obj,
+  const double* polarityValues,
+  const int simdLevel,
+  double* sums,                     //one per object
+  int tileVertices = -1             //object vertices per tile, -1 sizes them from L2, 0 is one tile
+);
+
+//sum of 1 / (polarity * dist^2) over the pairs closer than the grid's
+//radius, for every object of a buffer laid out like closestPairs. The object
+//vertices are sorted along a Morton curve and cut into runs of CUTOFF_RUN,
+//every run meets the magnet points near its box through the rowWithin
+//kernel of detectSimdLevel, always in double. Returns false, leaving sums
+//alone, when the radius covers every pair: the exact inverseSquareSums then
+//gives the same sums faster
+bool cutoffSums(
+  const CellGrid& magGrid,
+  const int numObjects,
+  const int* objStart,
+  double const* obj,
+  double* sums,                     //one per object
+  ScratchArena* scratch = NULL
+);
+
+//single precision copy of a planar buffer. The copy comes from scratch when
+//one is given, otherwise it is malloc'd and the caller frees it
+float* toSinglePrecision(const double* values, int count, ScratchArena* scratch = NULL);
+
+//polarity of every magnet vertex, positive above the middle of the magnet's
+//z range and negative below it
+void magnetPolarity(const int numMag, double const* mag, double* polarityValues);
+
+//magnetPolarity from the z values alone, for a magnet inside a larger planar buffer
+void magnetPolarityFromZ(const int numMag, double const* z, double* polarityValues);
+
+//largest part of the gap to the magnet that one sub-step of magnetForce
+//moves an object, see maxSubsteps
+const double SUBSTEP_GAP = 0.25;
+
+//moves every object vertex by the clamped average influence of the magnet.
+//With maxSubsteps above 1 an object that would cover more than SUBSTEP_GAP
+//of its distance to the magnet in one step takes shorter steps, measuring
+//the influence and the closest pair again after each, so a strong field
+//does not snap it onto the magnet in one jump. An attracted object leaves
+//what is left of its step when the sub-steps run out. Objects far from the
+//magnet still take one step, and the prepared magnet is reused by every
+//sub-step. A move never exceeds the gap, and attraction stops at the magnet
+void magnetForce(
+  const int numMag,
+  const int numObj,
+  const double tesla,
+  double const* mag,
+  const KdTree& magTree,            //tree over mag, see closestPair
+  const Octree& magOctree,          //tree over mag weighted by 1 / polarity
+  const double openingAngle,        //0 sums every pair, above 0 uses magOctree
+  const CellGrid& magGrid,          //grid over mag weighted by 1 / polarity
+  const double influenceRadius,     //above 0 only pairs closer than this count, uses magGrid
+  double* obj,
+  const double* polarityValues,     //1 if positive, -1 if negative
+  const int objectPolarity,         //1 if positive, 0 if negative
+  bool singlePrecision,             //evaluates the exact sum in float, the rest stays double
+  const int backend,                //one of BackendType, runs the exact sum
+  ScratchArena* scratch = NULL,     //holds the temporary buffers, NULL uses malloc
+  int maxSubsteps = 1               //most sub-steps an object takes, 1 is one step for all
+);
+
+//magnetForce for several objects stored like closestPairs expects, each is
+//moved by its own clamped average but the magnet is only walked once. Each
+//sub-step only walks the magnet for the objects still stepping
+void magnetForceBatch(
+  const int numMag,
+  const int numObjects,
+  const int* objStart,              //object k owns vertices objStart[k] up to objStart[k + 1]
+  const double tesla,
+  double const* mag,
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const double openingAngle,
+  const CellGrid& magGrid,
+  const double influenceRadius,
+  double* obj,                      //planar over objStart[numObjects] vertices
+  const double* polarityValues,
+  const int objectPolarity,
+  bool singlePrecision,
+  const int backend,
+  ScratchArena* scratch = NULL,
+  int maxSubsteps = 1
+);
+
+//moves every object vertex by its own field, the sum over the magnet of
+//(object - magnet) / (polarity * dist^3) scaled like magnetForce's average.
+//Each move is clamped to the distance between the vertex and its closest
+//magnet vertex. Vertices do not depend on each other, so several objects
+//concatenated into one buffer need no objStart
+void magnetField(
+  const int numMag,
+  const int numObj,
+  const double tesla,
+  double const* mag,
+  const KdTree& magTree,
+  const Octree& magOctree,
+  const double openingAngle,
+  const CellGrid& magGrid,
+  const double influenceRadius,
+  double* obj,
+  const double* polarityValues,
+  const int objectPolarity,
+  bool singlePrecision,
+  const int backend,
+  ScratchArena* scratch = NULL
+);
+
+//field of magnetField before scaling and clamping, planar over numObj
+//vertices, one OpenMP loop over the object. weights are 1 / polarity in the
+//precision of the pair arithmetic. The magnet is walked in tiles like the
+//object is in inverseSquareSums
+template <typename T>
+void inverseSquareField(
+  const int numMag,
+  const int numObj,
+  T const* mag,
+  T const* obj,
+  T const* weights,
+  const int simdLevel,
+  double* field,
+  int tileVertices = -1             //magnet vertices per tile, -1 sizes them from L2, 0 is one tile
+);
+
+//64 bit hash of a block of memory, used to tell whether an input changed
+//since the last evaluation. seed chains several blocks into one hash
+unsigned long long hashValues(const void* data, size_t bytes, unsigned long long seed);
+
+//picks three well spread points that fitRigidMotion measures the motion
+//with and returns the diagonal of the points' bounding box
+double pickRigidFrame(const int numPoints, double const* points, int* frame);
+
+//finds the rotation (3x3, row major) and translation that take reference
+//onto points. Returns false when the frame is degenerate or some point is
+//further than tolerance from where the motion puts its reference point
+bool fitRigidMotion(
+  const int numPoints,
+  double const* reference,
+  double const* points,
+  const int* frame,                 //see pickRigidFrame
+  const double tolerance,
+  double* rotation,
+  double* translation
+);
+
+//applies a rigid motion to planar points in place, or undoes it when inverse
+void applyRigidMotion(
+  const int numPoints,
+  const double* rotation,
+  const double* translation,
+  bool inverse,
+  double* points
+);
+
+#endif
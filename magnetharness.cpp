@@ -0,0 +1,272 @@
+//
+//  File: magnetharness.cpp
+//
+//  Description:
+//    Runs whole evaluations of the deformer, as finalproject::compute does
+//    them, against the in memory stand-in host of standinhost.h. Every stage
+//    of the pipeline runs, so the time spent outside the kernel can be
+//    measured and profiled (perf, VTune) without Maya, and the hash of the
+//    final outputs can be compared between builds and thread counts on one
+//    machine.
+//
+//    The magnets orbit the origin, one step per frame, so the evaluations
+//    see the same rigid motion an animated magnet gives in a scene.
+//
+//    magnetharness [options] [magnet.(obj|ply) object.(obj|ply) ...]
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pointcloud.h"
+#include "standinhost.h"
+
+static void usage(const char* name)
+{
+   printf("usage: %s [options] [magnet.(obj|ply) object.(obj|ply) ...]\n", name);
+   printf("  without files, spheres are generated\n");
+   printf("  -frames <n>           number of evaluations, default 24\n");
+   printf("  -magnets <n>          generated magnets, default 1\n");
+   printf("  -objects <n>          copies of every object, default 1\n");
+   printf("  -magnet-vertices <n>  vertices of a generated magnet, default 2000\n");
+   printf("  -vertices <n>         vertices of a generated object, default 20000\n");
+   printf("  -static               the magnets do not move\n");
+   printf("  -tesla <value>        magnetic strength, default 1\n");
+   printf("  -negative             the objects are negatively charged\n");
+   printf("  -angle <value>        Barnes-Hut opening angle, 0 sums every pair (default)\n");
+   printf("  -radius <value>       influence radius, 0 is off (default)\n");
+   printf("  -single               evaluates the influence sum in single precision\n");
+   printf("  -falloff              moves every vertex by its own field instead of one translation\n");
+   printf("  -backend <name>       simd (default), openmp, scalar or tbb\n");
+   printf("  -substeps <n>         most sub-steps of an object close to the magnet, default 1\n");
+   printf("  -proxies <n>          evaluates proxies of about n vertices each, 0 is off (default)\n");
+   printf("  -threads <n>          number of OpenMP threads\n");
+   printf("  -record <file>        records every frame into a bake\n");
+   printf("  -playback <file>      plays frames back from a bake\n");
+   printf("  -frame-times          prints the time of every evaluation\n");
+   printf("  -output <file>        writes the last output of the first object\n");
+}
+
+//fills the planar buffer pts with n points on a sphere of the given radius
+//around (cx, cy, cz)
+static void makeSphere(double* pts, int n, double radius, double cx, double cy, double cz)
+{
+   const double golden = M_PI * (3.0 - sqrt(5.0));
+   for (int i = 0; i < n; i++) {
+      double y = 1.0 - 2.0 * (i + 0.5) / n;
+      double r = sqrt(1.0 - y * y);
+      double theta = golden * i;
+      pts[i] = cx + radius * r * cos(theta);
+      pts[n + i] = cy + radius * y;
+      pts[2 * n + i] = cz + radius * r * sin(theta);
+   }
+}
+
+//rotates planar points about the z axis through the origin
+static void rotateZ(const double* pts, int n, double angle, double* out)
+{
+   const double c = cos(angle), s = sin(angle);
+   for (int i = 0; i < n; i++) {
+      out[i] = c * pts[i] - s * pts[n + i];
+      out[n + i] = s * pts[i] + c * pts[n + i];
+      out[2 * n + i] = pts[2 * n + i];
+   }
+}
+
+int main(int argc, char** argv)
+{
+   PipelineSettings settings;
+   settings.tesla = 1.0;
+   int frames = 24, numMagnets = 1, copies = 1, magVertices = 2000, objVertices = 20000;
+   bool animate = true, frameTimes = false;
+   const char* outputPath = NULL;
+   std::vector<const char*> paths;
+
+   for (int a = 1; a < argc; a++) {
+      if (!strcmp(argv[a], "-frames") && a + 1 < argc) {
+         frames = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-magnets") && a + 1 < argc) {
+         numMagnets = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-objects") && a + 1 < argc) {
+         copies = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-magnet-vertices") && a + 1 < argc) {
+         magVertices = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-vertices") && a + 1 < argc) {
+         objVertices = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-tesla") && a + 1 < argc) {
+         settings.tesla = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-angle") && a + 1 < argc) {
+         settings.openingAngle = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-radius") && a + 1 < argc) {
+         settings.influenceRadius = atof(argv[++a]);
+      } else if (!strcmp(argv[a], "-backend") && a + 1 < argc) {
+         a++;
+         for (settings.backend = 0; settings.backend < NUM_BACKENDS && strcmp(argv[a], backendName(settings.backend));
+            settings.backend++) {
+         }
+         if (!computeBackend(settings.backend)) {
+            printf("Backend %s is not available\n", argv[a]);
+            return 1;
+         }
+      } else if (!strcmp(argv[a], "-substeps") && a + 1 < argc) {
+         settings.maxSubsteps = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-proxies") && a + 1 < argc) {
+         settings.proxyVertices = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "-threads") && a + 1 < argc) {
+         omp_set_num_threads(atoi(argv[++a]));
+      } else if (!strcmp(argv[a], "-record") && a + 1 < argc) {
+         settings.bakeMode = BAKE_RECORD;
+         settings.bakeFile = argv[++a];
+      } else if (!strcmp(argv[a], "-playback") && a + 1 < argc) {
+         settings.bakeMode = BAKE_PLAYBACK;
+         settings.bakeFile = argv[++a];
+      } else if (!strcmp(argv[a], "-output") && a + 1 < argc) {
+         outputPath = argv[++a];
+      } else if (!strcmp(argv[a], "-static")) {
+         animate = false;
+      } else if (!strcmp(argv[a], "-frame-times")) {
+         frameTimes = true;
+      } else if (!strcmp(argv[a], "-negative")) {
+         settings.positive = false;
+      } else if (!strcmp(argv[a], "-single")) {
+         settings.singlePrecision = true;
+      } else if (!strcmp(argv[a], "-falloff")) {
+         settings.falloff = true;
+      } else if (argv[a][0] != '-') {
+         paths.push_back(argv[a]);
+      } else {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (frames < 1 || numMagnets < 1 || copies < 1 || magVertices < 1 || objVertices < 1 || settings.maxSubsteps < 1
+      || settings.proxyVertices < 0 || paths.size() == 1) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   //the magnets at rest and the objects, planar
+   std::vector<std::vector<double> > magnets, objects;
+   std::vector<int> magCounts, objCounts;
+   if (paths.empty()) {
+      for (int k = 0; k < numMagnets; k++) {
+         double angle = 2 * M_PI * k / numMagnets;
+         magnets.push_back(std::vector<double>(magVertices * 3));
+         makeSphere(&magnets.back()[0], magVertices, 0.5, 3 * cos(angle), 3 * sin(angle), 0);
+         magCounts.push_back(magVertices);
+      }
+      objects.push_back(std::vector<double>(objVertices * 3));
+      makeSphere(&objects.back()[0], objVertices, 1.0, 0, 0, 0);
+      objCounts.push_back(objVertices);
+   } else {
+      for (size_t p = 0; p < paths.size(); p++) {
+         std::vector<double> points;
+         int n;
+         if (!readPointCloud(paths[p], points, &n)) {
+            return 1;
+         }
+         (p == 0 ? magnets : objects).push_back(points);
+         (p == 0 ? magCounts : objCounts).push_back(n);
+      }
+   }
+
+   //copies of the objects are stacked along z, each is a geometry of its own
+   StandInHost host;
+   for (size_t k = 0; k < magnets.size(); k++) {
+      host.addMagnet(&magnets[k][0], magCounts[k], 1.0);
+   }
+   int totalObj = 0;
+   for (int c = 0; c < copies; c++) {
+      for (size_t o = 0; o < objects.size(); o++) {
+         std::vector<double> points = objects[o];
+         for (int i = 0; i < objCounts[o]; i++) {
+            points[2 * objCounts[o] + i] += 2.5 * c;
+         }
+         host.addGeometry((unsigned int)(c * objects.size() + o), &points[0], objCounts[o]);
+         totalObj += objCounts[o];
+      }
+   }
+   int totalMag = 0;
+   for (size_t k = 0; k < magnets.size(); k++) {
+      totalMag += magCounts[k];
+   }
+   printf("%d magnets of %d vertices, %d geometries of %d vertices, %d frames, %d threads, backend %s\n",
+      (int)magnets.size(), totalMag, host.numGeometries(), totalObj, frames, omp_get_max_threads(),
+      backendName(settings.backend));
+
+   MagnetPipeline pipeline;
+   settings.profile = true;
+   std::vector<double> moved;
+   for (int f = 0; f < frames; f++) {
+      if (animate && f > 0) {
+         for (size_t k = 0; k < magnets.size(); k++) {
+            moved.resize(magnets[k].size());
+            rotateZ(&magnets[k][0], magCounts[k], 2 * M_PI * f / frames, &moved[0]);
+            host.setMagnetPoints((int)k, &moved[0], magCounts[k]);
+         }
+         pipeline.magnetChanged();
+      }
+      host.pull();
+      settings.frame = f;
+      pipeline.evaluate(host, settings);
+   }
+
+   //the first evaluation builds the caches and is reported on its own, the
+   //log only keeps the most recent evaluations of long runs
+   std::vector<ProfileSample> samples(ProfileLog::CAPACITY);
+   int count = pipeline.profileLog.snapshot(&samples[0]);
+   int skip = count > 0 && samples[0].evaluation == 0 ? 1 : 0;
+   double total = 0, phases[NUM_PHASES] = {0};
+   for (int k = 0; k < count; k++) {
+      double seconds = 0;
+      for (int p = 0; p < NUM_PHASES; p++) {
+         seconds += samples[k].seconds[p];
+         if (k >= skip) {
+            phases[p] += samples[k].seconds[p];
+         }
+      }
+      if (frameTimes) {
+         printf("frame %lu: %.3f ms\n", samples[k].evaluation, seconds * 1000.0);
+      }
+      if (k < skip) {
+         printf("first evaluation %.3f ms\n", seconds * 1000.0);
+      } else {
+         total += seconds;
+      }
+   }
+   if (count > skip) {
+      printf("mean of %d evaluations:\n", count - skip);
+      for (int p = 0; p < NUM_PHASES; p++) {
+         printf("  %-10s %10.3f ms\n", ProfileLog::phaseName(p), phases[p] * 1000.0 / (count - skip));
+      }
+      printf("  %-10s %10.3f ms\n", "total", total * 1000.0 / (count - skip));
+   }
+
+   //the outputs after the last frame. Every sum is added in an order that
+   //only depends on the meshes, so the same settings give the same hash for
+   //any number of threads. The instruction set and the L2 tiles still pick
+   //the order, which can differ between machines
+   unsigned long long hash = host.numGeometries();
+   for (int g = 0; g < host.numGeometries(); g++) {
+      int n;
+      const double* out = host.output(g, &n);
+      hash = hashValues(out, sizeof(double) * 4 * n, hash);
+   }
+   printf("output hash %016llx\n", hash);
+
+   if (outputPath) {
+      int n;
+      const double* out = host.output(0, &n);
+      std::vector<double> planar(3 * n);
+      for (int i = 0; i < n; i++) {
+         planar[i] = out[4 * i];
+         planar[n + i] = out[4 * i + 1];
+         planar[2 * n + i] = out[4 * i + 2];
+      }
+      return writePointCloud(outputPath, &planar[0], n, paths.size() > 1 ? paths[1] : NULL) ? 0 : 1;
+   }
+   return 0;
+}
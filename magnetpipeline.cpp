@@ -0,0 +1,550 @@
+//
+//  File: magnetpipeline.cpp
+//
+//  Description:
+//    The stages of one evaluation, see magnetpipeline.h.
+//
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "magnetpipeline.h"
+
+//copies interleaved float xyz points, as stored by the mesh, into a planar
+//double buffer whose y and z values start stride values after the x ones,
+//adding offset to every point. The same pass finds the bounding box of the
+//points before the offset, {min x, max x, min y, max y, min z, max z}
+static void rawToPlanar(const float* raw, int numPoints, const double* offset, double* planar, int stride,
+   double* bounds)
+{
+   double minX = DBL_MAX, minY = DBL_MAX, minZ = DBL_MAX;
+   double maxX = -DBL_MAX, maxY = -DBL_MAX, maxZ = -DBL_MAX;
+   #pragma omp parallel for simd reduction (min: minX, minY, minZ) reduction (max: maxX, maxY, maxZ)
+   for (int i=0; i<numPoints; i++) {
+      double x = raw[3 * i], y = raw[3 * i + 1], z = raw[3 * i + 2];
+      planar[i] = x + offset[0];
+      planar[stride + i] = y + offset[1];
+      planar[2 * stride + i] = z + offset[2];
+      minX = x < minX ? x : minX;
+      maxX = x > maxX ? x : maxX;
+      minY = y < minY ? y : minY;
+      maxY = y > maxY ? y : maxY;
+      minZ = z < minZ ? z : minZ;
+      maxZ = z > maxZ ? z : maxZ;
+   }
+   bounds[0] = minX; bounds[1] = maxX;
+   bounds[2] = minY; bounds[3] = maxY;
+   bounds[4] = minZ; bounds[5] = maxZ;
+}
+
+//copies planar points into a planar buffer of their own and finds their
+//bounding box in the same pass, laid out like rawToPlanar's
+static void copyPlanar(const double* x, const double* y, const double* z, int numPoints, double* planar,
+   double* bounds)
+{
+   double minX = DBL_MAX, minY = DBL_MAX, minZ = DBL_MAX;
+   double maxX = -DBL_MAX, maxY = -DBL_MAX, maxZ = -DBL_MAX;
+   #pragma omp parallel for simd reduction (min: minX, minY, minZ) reduction (max: maxX, maxY, maxZ)
+   for (int i=0; i<numPoints; i++) {
+      planar[i] = x[i];
+      planar[numPoints + i] = y[i];
+      planar[2 * numPoints + i] = z[i];
+      minX = x[i] < minX ? x[i] : minX;
+      maxX = x[i] > maxX ? x[i] : maxX;
+      minY = y[i] < minY ? y[i] : minY;
+      maxY = y[i] > maxY ? y[i] : maxY;
+      minZ = z[i] < minZ ? z[i] : minZ;
+      maxZ = z[i] > maxZ ? z[i] : maxZ;
+   }
+   bounds[0] = minX; bounds[1] = maxX;
+   bounds[2] = minY; bounds[3] = maxY;
+   bounds[4] = minZ; bounds[5] = maxZ;
+}
+
+const MagnetPipeline::StageEntry MagnetPipeline::stages[NUM_STAGES] = {
+   {PHASE_FETCH, &MagnetPipeline::fetch},
+   {PHASE_WRITE, &MagnetPipeline::playback},
+   {PHASE_FETCH, &MagnetPipeline::hash},
+   {PHASE_COPY, &MagnetPipeline::copy},
+   {PHASE_POLARITY, &MagnetPipeline::prepare},
+   {PHASE_KERNEL, &MagnetPipeline::kernel},
+   {PHASE_BOUNDS, &MagnetPipeline::bounds},
+   {PHASE_WRITE, &MagnetPipeline::write},
+   {PHASE_WRITE, &MagnetPipeline::record}
+};
+
+MagnetPipeline::MagnetPipeline() : host(NULL), settings(NULL), magnetDirty(1), dirty(0), proxyVertices(0),
+   magnetHash(0), numInputs(0), numBatched(0), objNumPoints(0), objdVerts(NULL), objStart(NULL), pivots(NULL),
+   numProxies(0), proxyVerts(NULL), proxyStart(NULL)
+{
+   seedMove[0] = seedMove[1] = seedMove[2] = NAN;
+   omp_init_lock(&evaluating);
+}
+
+MagnetPipeline::~MagnetPipeline()
+{
+   omp_destroy_lock(&evaluating);
+}
+
+void MagnetPipeline::magnetChanged()
+{
+   #pragma omp atomic write
+   magnetDirty = 1;
+}
+
+void MagnetPipeline::evaluate(MagnetHost& host, const PipelineSettings& settings)
+{
+   this->host = &host;
+   this->settings = &settings;
+   numBatched = 0;
+   objNumPoints = 0;
+   numProxies = 0;
+
+   //the tbb backend runs the sums as tasks in the caller's arena. The loops
+   //around them stay OpenMP and run on one thread, so no second pool of
+   //threads competes with the TBB workers
+   const int ompThreads = omp_get_max_threads();
+   if (settings.backend == BACKEND_TBB) {
+      omp_set_num_threads(1);
+   }
+
+   //a bake keeps the full meshes, whatever the level of detail
+   proxyVertices = settings.bakeMode == BAKE_RECORD || settings.proxyVertices < 2 ? 0 : settings.proxyVertices;
+
+   //per phase timings are only taken when profiling is on, fetch starts with
+   //what the host spent before the pipeline ran
+   ProfileTimer timer(settings.profile);
+   timer.sample.seconds[PHASE_FETCH] = timer.enabled ? settings.fetchSeconds : 0;
+   for (int s = 0; s < NUM_STAGES; s++) {
+      bool more = (this->*stages[s].run)();
+      timer.lap(stages[s].phase);
+      if (!more) {
+         break;
+      }
+   }
+   if (timer.enabled) {
+      timer.sample.numObj = objNumPoints;
+      timer.sample.numMag = magStart.empty() ? 0 : magStart.back();
+      timer.sample.threads = omp_get_max_threads();
+      profileLog.record(timer.sample);
+   }
+   omp_set_num_threads(ompThreads);
+}
+
+bool MagnetPipeline::fetch()
+{
+   //the points are read straight out of the host's float storage
+   int numMagnets = host->numMagnets();
+   magRaw.resize(numMagnets);
+   magStart.resize(numMagnets + 1);
+   magStrengths.resize(numMagnets);
+   magStart[0] = 0;
+   for (int k = 0; k < numMagnets; k++) {
+      int n = 0;
+      magRaw[k] = host->magnetPoints(k, &n);
+      magStart[k + 1] = magStart[k] + (magRaw[k] ? n : 0);
+      magStrengths[k] = host->signedStrength(k);
+   }
+
+   numInputs = host->numGeometries();
+   geometries.resize(numInputs);
+   for (int g = 0; g < numInputs; g++) {
+      Geometry& geometry = geometries[g];
+      geometry.index = host->geometryIndex(g);
+      geometry.raw = host->geometryPoints(g, &geometry.numPoints);
+      if (!geometry.raw) {
+         geometry.numPoints = 0;
+      }
+      if (states.size() <= geometry.index) {
+         states.resize(geometry.index + 1);
+      }
+
+      //a geometry seen for the first time carries on from the translation
+      //the host kept for it, e.g. in a saved scene
+      GeometryState& state = states[geometry.index];
+      bool stored = false;
+      if (!state.restored) {
+         state.restored = true;
+         stored = host->storedMove(g, state.move);
+      }
+
+      //the first seed does not override a translation the host kept
+      if (geometry.index == 0 && stored && std::isnan(seedMove[0])) {
+         for (int a = 0; a < 3; a++) {
+            seedMove[a] = settings->seed[a];
+         }
+      }
+   }
+
+   //the seed only sets the stored translation of the geometry at logical
+   //index 0, a new value restarts it from there
+   const double* seed = settings->seed;
+   if (seed[0] != seedMove[0] || seed[1] != seedMove[1] || seed[2] != seedMove[2]) {
+      if (states.empty()) {
+         states.resize(1);
+      }
+      for (int a = 0; a < 3; a++) {
+         states[0].move[a] = seedMove[a] = seed[a];
+      }
+   }
+   return true;
+}
+
+//a baked frame is written back as it was recorded, frames missing from the
+//bake and bakes of other geometries are evaluated as usual
+bool MagnetPipeline::playback()
+{
+   if (settings->bakeMode != BAKE_RECORD && bake.recording()) {
+      bake.close();
+   }
+   if (settings->bakeMode != BAKE_PLAYBACK) {
+      if (bake.playing()) {
+         bake.close();
+      }
+      return true;
+   }
+   if (!bake.beginPlayback(settings->bakeFile)) {
+      return true;
+   }
+
+   const bool falloff = settings->falloff;
+   std::vector<int> counts(numInputs + 1);
+   for (int g = 0; g < numInputs; g++) {
+      counts[g] = geometries[g].numPoints;
+   }
+   const float* moves = bake.moves(settings->frame);
+   const float* points = bake.points(settings->frame);
+   if (!bake.matches(numInputs, &counts[0], falloff) || !moves || (falloff && !points)) {
+      return true;
+   }
+
+   //translate bakes keep the translation, the input points plus it give the
+   //output. Falloff bakes keep the output points themselves
+   for (int g = 0, offset = 0; g < numInputs; g++) {
+      const Geometry& geometry = geometries[g];
+      GeometryState& state = states[geometry.index];
+      const int n = geometry.numPoints;
+      const float* src = falloff ? points + 3 * offset : geometry.raw;
+      double add[3] = {0, 0, 0};
+      if (!falloff) {
+         for (int a = 0; a < 3; a++) {
+            add[a] = state.move[a] = moves[3 * g + a];
+         }
+      }
+      state.out.resize(3 * n);
+      double* out = state.out.data();
+      #pragma omp parallel for
+      for (int i = 0; i < n; i++) {
+         out[i] = src[3 * i] + add[0];
+         out[n + i] = src[3 * i + 1] + add[1];
+         out[2 * n + i] = src[3 * i + 2] + add[2];
+      }
+      state.numPoints = n;
+      host->writePoints(g, out, out + n, out + 2 * n, n);
+      host->writeMove(g, state.move);
+
+      //the next live evaluation starts from the baked translation
+      state.resultValid = false;
+      offset += n;
+   }
+   return false;
+}
+
+//the output of a geometry only depends on these inputs, when none of them
+//changed since its last evaluation its previous output is written again
+bool MagnetPipeline::hash()
+{
+   const int numMagnets = (int)magRaw.size();
+   const int magNumPoints = magStart[numMagnets];
+
+   //without a magnet the outputs stay the host's inputs. The translations
+   //stay where they were, but are still written so the host keeps them
+   if (magNumPoints == 0) {
+      for (int g = 0; g < numInputs; g++) {
+         host->writeMove(g, states[geometries[g].index].move);
+      }
+      return false;
+   }
+
+   //the dirty flag is taken in one step, a magnet that changes while this
+   //evaluation runs is seen by the next one
+   #pragma omp atomic capture
+   { dirty = magnetDirty; magnetDirty = 0; }
+   if (dirty || hashedStart != magStart) {
+      magnetHash = hashValues(&magStart[0], sizeof(int) * (numMagnets + 1), numMagnets);
+      for (int k = 0; k < numMagnets; k++) {
+         magnetHash = hashValues(magRaw[k], sizeof(float) * (magStart[k + 1] - magStart[k]) * 3, magnetHash);
+      }
+      hashedStart = magStart;
+   }
+   unsigned long long sharedHash = hashValues(&magnetHash, sizeof(magnetHash), numMagnets);
+   sharedHash = hashValues(&magStrengths[0], sizeof(double) * numMagnets, sharedHash);
+   double params[9] = {settings->tesla, (double)settings->positive, settings->openingAngle,
+      (double)settings->singlePrecision, (double)settings->falloff, settings->influenceRadius,
+      (double)settings->backend, (double)settings->maxSubsteps, (double)proxyVertices};
+   sharedHash = hashValues(params, sizeof(params), sharedHash);
+
+   for (int g = 0; g < numInputs; g++) {
+      Geometry& geometry = geometries[g];
+      const GeometryState& state = states[geometry.index];
+      geometry.hash = hashValues(geometry.raw, sizeof(float) * geometry.numPoints * 3, sharedHash);
+      geometry.hash = hashValues(state.move, sizeof(state.move), geometry.hash);
+
+      geometry.start = -1;
+      if (!state.resultValid || geometry.hash != state.resultHash || state.numPoints != geometry.numPoints) {
+         geometry.start = objNumPoints;
+         geometry.batch = numBatched++;
+         objNumPoints += geometry.numPoints;
+      }
+   }
+   return true;
+}
+
+//translates every object based on its stored position, the buffer is planar
+//(all x, then all y, then all z) with the objects one after the other. The
+//falloff mode does not accumulate, it always starts from the input. The copy
+//also finds the pivot point of each object in world space prior to being
+//affected by the magnet, the falloff mode has no use for it.
+//
+//With proxies in translate mode, every object's proxies are averaged from
+//its copied vertices into a planar buffer of the same layout, clustering the
+//vertices first when their count changed. The falloff mode moves every
+//vertex by its own field and keeps the vertices
+bool MagnetPipeline::copy()
+{
+   //every buffer below is only used during this evaluation
+   scratch.reset();
+   objdVerts = scratch.allocate<double>(objNumPoints * 3);
+   objStart = scratch.allocate<int>(numBatched + 1);
+   pivots = scratch.allocate<double>(numBatched * 6);
+   proxyStart = scratch.allocate<int>(numBatched + 1);
+   const int objectProxies = settings->falloff ? 0 : proxyVertices;
+   double noMove[3] = {0, 0, 0};
+
+   for (int g = 0; g < numInputs; g++) {
+      const Geometry& geometry = geometries[g];
+      if (geometry.start >= 0) {
+         GeometryState& state = states[geometry.index];
+         rawToPlanar(geometry.raw, geometry.numPoints, settings->falloff ? noMove : state.move,
+            objdVerts + geometry.start, objNumPoints, pivots + 6 * geometry.batch);
+         objStart[geometry.batch] = geometry.start;
+         if (objectProxies && !state.proxy.built(geometry.numPoints, objectProxies)) {
+            state.proxy.build(objdVerts + geometry.start, geometry.numPoints, objNumPoints, objectProxies);
+         }
+         proxyStart[geometry.batch] = numProxies;
+         numProxies += objectProxies ? state.proxy.size() : 0;
+      }
+   }
+   objStart[numBatched] = objNumPoints;
+   proxyStart[numBatched] = numProxies;
+
+   if (numProxies > 0) {
+      proxyVerts = scratch.allocate<double>(numProxies * 3);
+      for (int g = 0; g < numInputs; g++) {
+         const Geometry& geometry = geometries[g];
+         if (geometry.start >= 0) {
+            states[geometry.index].proxy.gather(objdVerts + geometry.start, objNumPoints,
+               proxyVerts + proxyStart[geometry.batch], numProxies);
+         }
+      }
+   }
+   return true;
+}
+
+//polarity, the planar magnet points and the trees only depend on the
+//magnets, so they are prepared once per magnet shape. All magnets are
+//concatenated so the kernel makes a single pass over the objects
+bool MagnetPipeline::prepare()
+{
+   const int numMagnets = (int)magRaw.size();
+   const int magNumPoints = magStart[numMagnets];
+   if (numBatched == 0) {
+      return true;
+   }
+   if (proxyVertices) {
+      return prepareProxies();
+   }
+   if (magnetHash != magnet.hash() || magnet.size() != magNumPoints || magnet.magnets() != numMagnets) {
+      double* magdVerts = scratch.allocate<double>(magNumPoints * 3);
+      double noMove[3] = {0, 0, 0};
+      double magBounds[6];
+      for (int k = 0; k < numMagnets; k++) {
+         rawToPlanar(magRaw[k], magStart[k + 1] - magStart[k], noMove, magdVerts + magStart[k], magNumPoints,
+            magBounds);
+      }
+      magnet.update(magdVerts, magNumPoints, &magStart[0], numMagnets, magnetHash);
+   }
+   magnet.setStrengths(&magStrengths[0]);
+   if (settings->openingAngle > 0) {
+      magnet.buildOctree();
+   }
+   magnet.buildGrid(settings->influenceRadius);
+   return true;
+}
+
+//the magnet proxies get the summed charge (1 / polarity) of the vertices
+//they stand for, so the sum over the proxies weighs every vertex once. The
+//clusters are kept per magnet, the proxies and their trees are brought up to
+//date with the magnet
+bool MagnetPipeline::prepareProxies()
+{
+   const int numMagnets = (int)magRaw.size();
+   const int magNumPoints = magStart[numMagnets];
+   unsigned long long proxyHash = hashValues(&proxyVertices, sizeof(proxyVertices), magnetHash);
+   if (proxyHash != proxyMagnet.hash() || proxyMagnet.magnets() != numMagnets) {
+      double* magdVerts = scratch.allocate<double>(magNumPoints * 3);
+      double* charges = scratch.allocate<double>(magNumPoints);
+      double noMove[3] = {0, 0, 0};
+      double magBounds[6];
+      magnetProxies.resize(numMagnets);
+      proxyMagStart.resize(numMagnets + 1);
+      proxyMagStart[0] = 0;
+      for (int k = 0; k < numMagnets; k++) {
+         const int n = magStart[k + 1] - magStart[k];
+         rawToPlanar(magRaw[k], n, noMove, magdVerts + magStart[k], magNumPoints, magBounds);
+         if (!magnetProxies[k].built(n, proxyVertices)) {
+            magnetProxies[k].build(magdVerts + magStart[k], n, magNumPoints, proxyVertices);
+         }
+         proxyMagStart[k + 1] = proxyMagStart[k] + magnetProxies[k].size();
+         if (n) {
+            magnetPolarityFromZ(n, magdVerts + 2 * magNumPoints + magStart[k], charges + magStart[k]);
+         }
+         for (int i = magStart[k]; i < magStart[k + 1]; i++) {
+            charges[i] = 1.0 / charges[i];
+         }
+      }
+
+      const int numMagProxies = proxyMagStart[numMagnets];
+      double* proxyPoints = scratch.allocate<double>(numMagProxies * 3);
+      double* proxyPolarity = scratch.allocate<double>(numMagProxies);
+      for (int k = 0; k < numMagnets; k++) {
+         magnetProxies[k].gather(magdVerts + magStart[k], magNumPoints, proxyPoints + proxyMagStart[k],
+            numMagProxies);
+         magnetProxies[k].sum(charges + magStart[k], proxyPolarity + proxyMagStart[k]);
+      }
+      for (int c = 0; c < numMagProxies; c++) {
+         proxyPolarity[c] = 1.0 / proxyPolarity[c];
+      }
+      proxyMagnet.update(proxyPoints, numMagProxies, &proxyMagStart[0], numMagnets, proxyHash, proxyPolarity);
+   }
+   proxyMagnet.setStrengths(&magStrengths[0]);
+   if (settings->openingAngle > 0) {
+      proxyMagnet.buildOctree();
+   }
+   proxyMagnet.buildGrid(settings->influenceRadius);
+   return true;
+}
+
+//main function call, one pass over the magnets for all objects. With
+//proxies the pass is over the magnet proxies, and in translate mode over the
+//object proxies too, every vertex then moves as far as its proxy did
+bool MagnetPipeline::kernel()
+{
+   const MagnetCache& source = proxyVertices ? proxyMagnet : magnet;
+   if (numProxies > 0) {
+      double* before = scratch.allocate<double>(numProxies * 3);
+      memcpy(before, proxyVerts, sizeof(double) * numProxies * 3);
+      source.forceBatch(numBatched, proxyStart, settings->tesla, settings->openingAngle, proxyVerts,
+         settings->positive, settings->singlePrecision, settings->backend, &scratch, settings->maxSubsteps);
+      for (int g = 0; g < numInputs; g++) {
+         const Geometry& geometry = geometries[g];
+         if (geometry.start >= 0) {
+            states[geometry.index].proxy.scatter(before + proxyStart[geometry.batch],
+               proxyVerts + proxyStart[geometry.batch], numProxies, objdVerts + geometry.start, objNumPoints);
+         }
+      }
+   } else if (numBatched > 0 && settings->falloff) {
+      source.field(objNumPoints, settings->tesla, settings->openingAngle, objdVerts, settings->positive,
+         settings->singlePrecision, settings->backend, &scratch);
+   } else if (numBatched > 0) {
+      source.forceBatch(numBatched, objStart, settings->tesla, settings->openingAngle, objdVerts,
+         settings->positive, settings->singlePrecision, settings->backend, &scratch, settings->maxSubsteps);
+   }
+   return true;
+}
+
+//keeps the output of every evaluated geometry for the evaluations that reuse
+//it. The copy also finds the pivot point of the object in world space after
+//being affected by the magnet
+bool MagnetPipeline::bounds()
+{
+   for (int g = 0; g < numInputs; g++) {
+      const Geometry& geometry = geometries[g];
+      if (geometry.start < 0) {
+         continue;
+      }
+      GeometryState& state = states[geometry.index];
+      state.out.resize(3 * geometry.numPoints);
+      double objCenter[6];
+      copyPlanar(objdVerts + geometry.start, objdVerts + objNumPoints + geometry.start,
+         objdVerts + 2 * objNumPoints + geometry.start, geometry.numPoints, state.out.data(), objCenter);
+
+      //stores the vector between the two pivot points for the next evaluation
+      if (!settings->falloff && settings->tesla) {
+         const double* pivot = pivots + 6 * geometry.batch;
+         state.move[0] = (float)((objCenter[0] + objCenter[1]) / 2 - (pivot[0] + pivot[1]) / 2);
+         state.move[1] = (float)((objCenter[2] + objCenter[3]) / 2 - (pivot[2] + pivot[3]) / 2);
+         state.move[2] = (float)((objCenter[4] + objCenter[5]) / 2 - (pivot[4] + pivot[5]) / 2);
+      }
+      state.numPoints = geometry.numPoints;
+      state.resultHash = geometry.hash;
+      state.resultValid = true;
+   }
+   return true;
+}
+
+bool MagnetPipeline::write()
+{
+   for (int g = 0; g < numInputs; g++) {
+      const GeometryState& state = states[geometries[g].index];
+      const int n = state.numPoints;
+      const double* out = state.out.data();
+      host->writePoints(g, out, out + n, out + 2 * n, n);
+      host->writeMove(g, state.move);
+   }
+   return true;
+}
+
+//writes the outputs of this evaluation into the bake under its frame
+bool MagnetPipeline::record()
+{
+   if (settings->bakeMode != BAKE_RECORD) {
+      return true;
+   }
+   const bool falloff = settings->falloff;
+   std::vector<int> counts(numInputs + 1);
+   std::vector<float> moves(3 * numInputs + 1);
+   int total = 0;
+   for (int g = 0; g < numInputs; g++) {
+      const Geometry& geometry = geometries[g];
+      counts[g] = geometry.numPoints;
+      for (int a = 0; a < 3; a++) {
+         moves[3 * g + a] = falloff ? 0 : (float)states[geometry.index].move[a];
+      }
+      total += geometry.numPoints;
+   }
+   //a bake that cannot be written leaves the evaluation as it is
+   if (!bake.beginRecord(settings->bakeFile, numInputs, &counts[0], falloff)) {
+      return true;
+   }
+
+   float* points = NULL;
+   if (falloff) {
+      points = scratch.allocate<float>(3 * total + 1);
+      for (int g = 0, offset = 0; g < numInputs; g++) {
+         const double* out = states[geometries[g].index].out.data();
+         const int n = counts[g];
+         float* dst = points + 3 * offset;
+         #pragma omp parallel for
+         for (int i = 0; i < n; i++) {
+            dst[3 * i] = (float)out[i];
+            dst[3 * i + 1] = (float)out[n + i];
+            dst[3 * i + 2] = (float)out[2 * n + i];
+         }
+         offset += n;
+      }
+   }
+   bake.record(settings->frame, &moves[0], points);
+   return true;
+}
@@ -0,0 +1,246 @@
+//
+//  File: magnetpipeline.h
+//
+//  Description:
+//    One evaluation of the magnet deformer, independent of the host that
+//    runs it. Everything the evaluation reads from or writes to the scene
+//    goes through MagnetHost, so the Maya node (finalproject.cpp) and the
+//    in memory stand-in (standinhost.h) run exactly the same code: point
+//    reads, hashing, the kernel buffer copies, polarity and trees, the
+//    kernel, the bounding box passes, the output writes and the bake.
+//
+//    The evaluation is a fixed table of stages run in order. Each stage
+//    reads what the stages before it left in the pipeline and can end the
+//    evaluation early, e.g. playback when the bake holds the frame or the
+//    copy when there is no magnet. Every stage is timed into one of the
+//    ProfilePhase columns when profiling is on.
+//
+//    With proxyVertices set, the kernel runs over level of detail proxies of
+//    the magnets (see proxycloud.h) instead of their vertices. In translate
+//    mode the geometries are replaced by proxies as well and every vertex
+//    follows its proxy, the falloff mode keeps their vertices since each one
+//    moves by its own field. Recording a bake always evaluates the full
+//    meshes.
+//
+
+#ifndef MAGNETPIPELINE_H
+#define MAGNETPIPELINE_H
+
+#include <vector>
+
+#include "bakecache.h"
+#include "magnetcache.h"
+#include "magnetprofile.h"
+#include "proxycloud.h"
+#include "scratcharena.h"
+
+//the scene as one evaluation sees it. Points are world space, interleaved
+//float xyz like a mesh stores them, and have to stay valid until the
+//evaluation returns
+class MagnetHost
+{
+public:
+   virtual ~MagnetHost() {}
+
+   //connected magnets, their points and signed strength (a negative
+   //strength reverses the magnet's polarity)
+   virtual int numMagnets() = 0;
+   virtual const float* magnetPoints(int k, int* numPoints) = 0;
+   virtual double signedStrength(int k) = 0;
+
+   //connected input geometries. The logical index keys the state the
+   //pipeline keeps for a geometry between evaluations
+   virtual int numGeometries() = 0;
+   virtual unsigned int geometryIndex(int g) = 0;
+   virtual const float* geometryPoints(int g, int* numPoints) = 0;
+
+   //sets the output points of geometry g from planar buffers, outputs that
+   //are not written keep their input points
+   virtual void writePoints(int g, const double* x, const double* y, const double* z, int numPoints) = 0;
+
+   //the stored translation of geometry g is kept by the host as well, so a
+   //saved or copied scene carries on from it. storedMove is asked once per
+   //logical index, the first time the pipeline sees it, and returns false
+   //when the host holds none for it
+   virtual bool storedMove(int g, double move[3]) = 0;
+   virtual void writeMove(int g, const double move[3]) = 0;
+};
+
+//holds an OpenMP lock until the end of the scope, whichever way it is left
+class ScopedLock
+{
+public:
+   explicit ScopedLock(omp_lock_t* lock) : lock(lock) { omp_set_lock(lock); }
+   ~ScopedLock() { omp_unset_lock(lock); }
+
+private:
+   omp_lock_t* lock;
+};
+
+//values of PipelineSettings::bakeMode
+enum PipelineBake { BAKE_OFF, BAKE_RECORD, BAKE_PLAYBACK };
+
+//every input of an evaluation that is not a mesh
+struct PipelineSettings
+{
+   PipelineSettings() : tesla(0), positive(true), openingAngle(0), influenceRadius(0), singlePrecision(false),
+      falloff(false), backend(BACKEND_SIMD), maxSubsteps(1), proxyVertices(0), bakeMode(BAKE_OFF), bakeFile(""),
+      frame(0), profile(false), fetchSeconds(0)
+   {
+      seed[0] = seed[1] = seed[2] = 0;
+   }
+
+   double tesla;             //magnetic strength
+   bool positive;            //polarity of the objects
+   double openingAngle;      //Barnes-Hut accuracy, 0 computes every pair
+   double influenceRadius;   //pairs further apart are skipped, 0 keeps every pair
+   bool singlePrecision;     //influence sum in float instead of double
+   bool falloff;             //per vertex field instead of one translation per object
+   int backend;              //see BackendType
+   int maxSubsteps;          //most sub-steps of the translation, see magnetForce
+   int proxyVertices;        //vertices per level of detail proxy, below 2 evaluates the full meshes
+   int bakeMode;             //see PipelineBake
+   const char* bakeFile;
+   int frame;                //frame a bake records or plays back
+   double seed[3];           //translation of geometry 0, a new value restarts it from there,
+                             //see MagnetHost::storedMove for the translation kept by the host
+   bool profile;             //records the stage timings into profileLog
+   double fetchSeconds;      //time the host took to read its inputs before evaluate, added to fetch
+};
+
+class MagnetPipeline
+{
+public:
+   MagnetPipeline();
+   ~MagnetPipeline();
+
+   //runs every stage against the host's current inputs. A caller that may
+   //evaluate one pipeline from several threads holds evaluationLock around
+   //the evaluation and whatever it reads into the host for it, so that
+   //evaluations run one at a time
+   void evaluate(MagnetHost& host, const PipelineSettings& settings);
+
+   //the lock evaluate runs under, see evaluate
+   omp_lock_t* evaluationLock() { return &evaluating; }
+
+   //the magnets changed, their points are hashed again by the next
+   //evaluation. Can be called from any thread while evaluate runs
+   void magnetChanged();
+
+   //geometries the last evaluation saw, in host order
+   int numGeometries() const { return numInputs; }
+
+   //the stages, in the order they run
+   enum Stage {
+      STAGE_FETCH,      //magnet and geometry points from the host
+      STAGE_PLAYBACK,   //the baked frame instead of the rest
+      STAGE_HASH,       //which geometries have to be evaluated again
+      STAGE_COPY,       //geometries into the planar kernel buffer, and their proxies
+      STAGE_PREPARE,    //polarity, planar magnet points and trees, or the magnet proxies
+      STAGE_KERNEL,     //magnetForce or magnetField
+      STAGE_BOUNDS,     //stored outputs and translations
+      STAGE_WRITE,      //outputs back to the host
+      STAGE_RECORD,     //this frame into the bake
+      NUM_STAGES
+   };
+
+   ProfileLog profileLog;   //timings of the most recent profiled evaluations
+
+private:
+   MagnetPipeline(const MagnetPipeline&);
+   MagnetPipeline& operator=(const MagnetPipeline&);
+
+   //every stage returns false to end the evaluation after it
+   bool fetch();
+   bool playback();
+   bool hash();
+   bool copy();
+   bool prepare();
+   bool kernel();
+   bool bounds();
+   bool write();
+   bool record();
+
+   //prepare for the magnet proxies
+   bool prepareProxies();
+
+   struct StageEntry
+   {
+      ProfilePhase phase;           //column the stage is timed into
+      bool (MagnetPipeline::*run)();
+   };
+   static const StageEntry stages[NUM_STAGES];
+
+   //one connected input geometry during an evaluation
+   struct Geometry
+   {
+      unsigned int index;       //logical index
+      const float* raw;         //input points
+      int numPoints;
+      unsigned long long hash;  //hash of every input its output depends on
+      int start;                //first vertex in the batch, -1 when the last output is reused
+      int batch;                //object number in the batch
+   };
+
+   //what is kept for an input geometry between evaluations
+   struct GeometryState
+   {
+      GeometryState() : resultHash(0), resultValid(false), restored(false), numPoints(0)
+      {
+         move[0] = move[1] = move[2] = 0;
+      }
+
+      unsigned long long resultHash;  //hash of every input out came from
+      bool resultValid;
+      bool restored;                  //move was asked from the host, see MagnetHost::storedMove
+      double move[3];                 //stored translation
+      int numPoints;
+      std::vector<double> out;        //planar output points, reused between evaluations
+      ProxyCloud proxy;               //clusters of the vertices, kept until the vertex count changes
+   };
+
+   //evaluate and magnetChanged may run on other threads than the one that
+   //created the pipeline. Everything below is only touched by evaluate, whose
+   //caller holds evaluating, apart from magnetDirty which is only read and
+   //written atomically
+   omp_lock_t evaluating;
+
+   //the running evaluation
+   MagnetHost* host;
+   const PipelineSettings* settings;
+
+   MagnetCache magnet;       //polarity, planar points and trees of all magnets together
+   MagnetCache proxyMagnet;  //the same for the magnet proxies
+   int magnetDirty;          //set when a magnet changed, taken by the evaluation that rehashes it
+   int dirty;                //magnetDirty as this evaluation took it
+   double seedMove[3];       //settings.seed as last seen, NAN before the first evaluation
+   int proxyVertices;        //settings.proxyVertices as this evaluation uses it, 0 for the full meshes
+
+   //per magnet inputs of one evaluation, kept so their storage is reused
+   std::vector<const float*> magRaw;
+   std::vector<int> magStart;         //first vertex of every magnet in the concatenated points
+   std::vector<double> magStrengths;
+   unsigned long long magnetHash;     //hash of the magnet points, kept between evaluations
+   std::vector<int> hashedStart;      //magStart when magnetHash was taken
+   std::vector<ProxyCloud> magnetProxies;  //clusters of every magnet
+   std::vector<int> proxyMagStart;         //first proxy of every magnet
+
+   std::vector<Geometry> geometries;      //input geometries of the current evaluation
+   std::vector<GeometryState> states;     //indexed by logical input index
+   int numInputs;
+
+   //kernel buffers of the current evaluation, see copy
+   int numBatched;
+   int objNumPoints;
+   double* objdVerts;
+   int* objStart;
+   double* pivots;
+   int numProxies;       //geometry proxies of the batch, 0 without proxies or in falloff mode
+   double* proxyVerts;   //planar like objdVerts
+   int* proxyStart;      //first proxy of every batched object
+
+   ScratchArena scratch;  //kernel buffers of one evaluation, kept until the pipeline is deleted
+   BakeCache bake;        //open while bakeMode records or plays back
+};
+
+#endif
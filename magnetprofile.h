@@ -0,0 +1,120 @@
+//
+//  File: magnetprofile.h
+//
+//  Description:
+//    Opt-in per evaluation instrumentation. Each evaluation records how long
+//    every phase of the magnet step took, together with the vertex and thread
+//    counts, into a fixed size ring buffer that can be dumped later.
+//
+
+#ifndef MAGNETPROFILE_H
+#define MAGNETPROFILE_H
+
+#include <cstring>
+#include "omp.h"
+
+//phases of one evaluation, in the order they run
+enum ProfilePhase {
+   PHASE_FETCH,      //data block reads, mesh handles, point reads and hashing
+   PHASE_COPY,       //copies into the kernel buffers
+   PHASE_POLARITY,   //polarity and the cached magnet trees
+   PHASE_KERNEL,     //magnetForce
+   PHASE_BOUNDS,     //kept outputs and their bounding boxes for the stored translation
+   PHASE_WRITE,      //writing the output positions, bake playback and recording
+   NUM_PHASES
+};
+
+struct ProfileSample
+{
+   unsigned long evaluation;        //running count of recorded evaluations
+   double seconds[NUM_PHASES];
+   int numObj;
+   int numMag;
+   int threads;
+};
+
+//keeps the last CAPACITY samples, older ones are overwritten
+class ProfileLog
+{
+public:
+   enum { CAPACITY = 256 };
+
+   ProfileLog() : next(0), count(0), evaluations(0)
+   {
+      omp_init_lock(&lock);
+   }
+
+   ~ProfileLog()
+   {
+      omp_destroy_lock(&lock);
+   }
+
+   void record(ProfileSample sample)
+   {
+      omp_set_lock(&lock);
+      sample.evaluation = evaluations++;
+      samples[next] = sample;
+      next = (next + 1) % CAPACITY;
+      count = count < CAPACITY ? count + 1 : CAPACITY;
+      omp_unset_lock(&lock);
+   }
+
+   //copies the recorded samples, oldest first, into out (CAPACITY entries)
+   //and returns how many there are
+   int snapshot(ProfileSample* out)
+   {
+      omp_set_lock(&lock);
+      int n = count;
+      for (int k = 0; k < n; k++) {
+         out[k] = samples[(next - n + k + CAPACITY) % CAPACITY];
+      }
+      omp_unset_lock(&lock);
+      return n;
+   }
+
+   void clear()
+   {
+      omp_set_lock(&lock);
+      next = count = 0;
+      omp_unset_lock(&lock);
+   }
+
+   static const char* phaseName(int phase)
+   {
+      static const char* names[NUM_PHASES] = {"fetch", "copy", "polarity", "kernel", "bounds", "write"};
+      return names[phase];
+   }
+
+private:
+   ProfileSample samples[CAPACITY];
+   int next;
+   int count;
+   unsigned long evaluations;
+   omp_lock_t lock;
+};
+
+//adds the time since the previous lap to the given phase, does nothing
+//unless enabled so that profiling costs a branch when it is off
+class ProfileTimer
+{
+public:
+   explicit ProfileTimer(bool enabled) : enabled(enabled), last(enabled ? omp_get_wtime() : 0)
+   {
+      memset(&sample, 0, sizeof(sample));
+   }
+
+   void lap(ProfilePhase phase)
+   {
+      if (enabled) {
+         double now = omp_get_wtime();
+         sample.seconds[phase] += now - last;
+         last = now;
+      }
+   }
+
+   bool enabled;
+   double last;
+   ProfileSample sample;
+};
+
+#endif
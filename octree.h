@@ -0,0 +1,314 @@
+//
+//  File: octree.h
+//
+//  Description:
+//    Barnes-Hut octree over the magnet vertices. Approximates the sum of
+//    weight / dist^2 over all magnet vertices by treating far away cells as a
+//    single point, which brings the influence sum from O(numMag * numObj)
+//    down to roughly O(numObj log numMag). The same cells give the vector
+//    field behind the per vertex falloff mode.
+//
+
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+class Octree
+{
+public:
+   Octree() : count(0) {}
+
+   //builds the tree from numPoints planar points (all x, then all y, then all z)
+   //with one weight each, both inputs are copied
+   void build(const double* points, const double* weights, int numPoints)
+   {
+      count = numPoints;
+      nodes.clear();
+      pts.resize(count * 3);
+      wts.resize(count);
+      idx.resize(count);
+      for (int i = 0; i < count; i++) {
+         idx[i] = i;
+      }
+      if (count == 0) {
+         return;
+      }
+
+      //root cell is the bounding cube of all points
+      double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+      double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+      for (int i = 0; i < count; i++) {
+         for (int a = 0; a < 3; a++) {
+            double v = points[a * count + i];
+            min[a] = v < min[a] ? v : min[a];
+            max[a] = v > max[a] ? v : max[a];
+         }
+      }
+      double center[3], half = 0;
+      for (int a = 0; a < 3; a++) {
+         center[a] = (min[a] + max[a]) / 2;
+         half = (max[a] - min[a]) / 2 > half ? (max[a] - min[a]) / 2 : half;
+      }
+
+      std::vector<int> scratch(count);
+      split(points, weights, center, half, 0, count, 0, scratch);
+
+      for (int k = 0; k < count; k++) {
+         pts[k * 3 + 0] = points[idx[k]];
+         pts[k * 3 + 1] = points[count + idx[k]];
+         pts[k * 3 + 2] = points[2 * count + idx[k]];
+         wts[k] = weights[idx[k]];
+      }
+   }
+
+   //replaces the weights of the points the tree was built from and refreshes
+   //the aggregate charges, the cells stay as they are
+   void reweight(const double* weights)
+   {
+      for (int k = 0; k < count; k++) {
+         wts[k] = weights[idx[k]];
+      }
+      #pragma omp parallel for schedule(dynamic, 64)
+      for (int n = 0; n < (int)nodes.size(); n++) {
+         Node& node = nodes[n];
+         node.posWeight = node.negWeight = 0;
+         for (int a = 0; a < 3; a++) {
+            node.posCenter[a] = node.negCenter[a] = 0;
+         }
+         for (int k = node.lo; k < node.hi; k++) {
+            double w = wts[k];
+            if (w >= 0) {
+               node.posWeight += w;
+               for (int a = 0; a < 3; a++) node.posCenter[a] += w * pts[k * 3 + a];
+            } else {
+               node.negWeight += w;
+               for (int a = 0; a < 3; a++) node.negCenter[a] += w * pts[k * 3 + a];
+            }
+         }
+         for (int a = 0; a < 3; a++) {
+            node.posCenter[a] = node.posWeight != 0 ? node.posCenter[a] / node.posWeight : node.center[a];
+            node.negCenter[a] = node.negWeight != 0 ? node.negCenter[a] / node.negWeight : node.center[a];
+         }
+      }
+   }
+
+   void clear()
+   {
+      count = 0;
+      nodes.clear();
+   }
+
+   int size() const { return count; }
+
+   //sum of weight / dist^2 between q and every point, cells whose size over
+   //distance is below openingAngle are evaluated from their aggregate charges
+   double inverseSquare(const double* q, double openingAngle) const
+   {
+      return count > 0 ? visit(0, q, openingAngle * openingAngle) : 0;
+   }
+
+   //vector field weight * (q - p) / dist^3 summed over every point, the
+   //direction of each inverseSquare term. Cells are accepted the same way
+   void inverseSquareField(const double* q, double openingAngle, double* field) const
+   {
+      field[0] = field[1] = field[2] = 0;
+      if (count > 0) {
+         visitField(0, q, openingAngle * openingAngle, field);
+      }
+   }
+
+   //sum of inverseSquare over numQuery planar points
+   double inverseSquareSum(int numQuery, const double* query, double openingAngle) const
+   {
+      double sum = 0;
+      #pragma omp parallel for reduction (+: sum)
+      for (int j = 0; j < numQuery; j++) {
+         double q[3] = {query[j], query[numQuery + j], query[2 * numQuery + j]};
+         sum += inverseSquare(q, openingAngle);
+      }
+      return sum;
+   }
+
+private:
+   //cells at or below this size, or this deep, are evaluated exactly
+   enum { LEAF_SIZE = 8, MAX_DEPTH = 20 };
+
+   struct Node
+   {
+      double center[3];    //geometric center of the cell
+      double size;         //edge length of the cell
+      int lo, hi;          //range of points in tree order
+      int child[8];        //-1 if the octant is empty, all -1 for leaves
+
+      //positive and negative weights are aggregated separately so that a cell
+      //of mixed polarity still has a well defined center for each sign
+      double posWeight, posCenter[3];
+      double negWeight, negCenter[3];
+   };
+
+   int split(const double* points, const double* weights, const double* center, double half,
+      int lo, int hi, int depth, std::vector<int>& scratch)
+   {
+      int n = (int)nodes.size();
+      nodes.push_back(Node());
+      Node node;
+      node.size = half * 2;
+      node.lo = lo;
+      node.hi = hi;
+      node.posWeight = node.negWeight = 0;
+      for (int a = 0; a < 3; a++) {
+         node.center[a] = center[a];
+         node.posCenter[a] = node.negCenter[a] = 0;
+      }
+      for (int c = 0; c < 8; c++) {
+         node.child[c] = -1;
+      }
+
+      for (int k = lo; k < hi; k++) {
+         double w = weights[idx[k]];
+         double p[3] = {points[idx[k]], points[count + idx[k]], points[2 * count + idx[k]]};
+         if (w >= 0) {
+            node.posWeight += w;
+            for (int a = 0; a < 3; a++) node.posCenter[a] += w * p[a];
+         } else {
+            node.negWeight += w;
+            for (int a = 0; a < 3; a++) node.negCenter[a] += w * p[a];
+         }
+      }
+      for (int a = 0; a < 3; a++) {
+         node.posCenter[a] = node.posWeight != 0 ? node.posCenter[a] / node.posWeight : center[a];
+         node.negCenter[a] = node.negWeight != 0 ? node.negCenter[a] / node.negWeight : center[a];
+      }
+
+      if (hi - lo > LEAF_SIZE && depth < MAX_DEPTH) {
+         //counting sort of the range into its eight octants
+         int start[9] = {0};
+         for (int k = lo; k < hi; k++) {
+            start[octant(points, idx[k], center) + 1]++;
+         }
+         for (int c = 0; c < 8; c++) {
+            start[c + 1] += start[c];
+         }
+         int fill[8];
+         for (int c = 0; c < 8; c++) {
+            fill[c] = lo + start[c];
+         }
+         for (int k = lo; k < hi; k++) {
+            scratch[fill[octant(points, idx[k], center)]++] = idx[k];
+         }
+         for (int k = lo; k < hi; k++) {
+            idx[k] = scratch[k];
+         }
+
+         for (int c = 0; c < 8; c++) {
+            if (start[c + 1] > start[c]) {
+               double childCenter[3];
+               for (int a = 0; a < 3; a++) {
+                  childCenter[a] = center[a] + ((c >> a) & 1 ? half : -half) / 2;
+               }
+               node.child[c] = split(points, weights, childCenter, half / 2,
+                  lo + start[c], lo + start[c + 1], depth + 1, scratch);
+            }
+         }
+      }
+
+      nodes[n] = node;
+      return n;
+   }
+
+   int octant(const double* points, int i, const double* center) const
+   {
+      return (points[i] > center[0] ? 1 : 0) | (points[count + i] > center[1] ? 2 : 0)
+         | (points[2 * count + i] > center[2] ? 4 : 0);
+   }
+
+   static double inverseSquareTo(const double* q, const double* p, double w)
+   {
+      double dx = p[0] - q[0];
+      double dy = p[1] - q[1];
+      double dz = p[2] - q[2];
+      return w / (dx * dx + dy * dy + dz * dz);
+   }
+
+   static void inverseSquareFieldTo(const double* q, const double* p, double w, double* field)
+   {
+      double dx = q[0] - p[0];
+      double dy = q[1] - p[1];
+      double dz = q[2] - p[2];
+      double distSq = dx * dx + dy * dy + dz * dz;
+      double s = w / (distSq * sqrt(distSq));
+      field[0] += s * dx;
+      field[1] += s * dy;
+      field[2] += s * dz;
+   }
+
+   void visitField(int n, const double* q, double angleSq, double* field) const
+   {
+      const Node& node = nodes[n];
+
+      //same acceptance test as visit, empty aggregates have no center to point from
+      double dx = node.center[0] - q[0];
+      double dy = node.center[1] - q[1];
+      double dz = node.center[2] - q[2];
+      double distSq = dx * dx + dy * dy + dz * dz;
+      if (node.size * node.size < angleSq * distSq) {
+         if (node.posWeight != 0) inverseSquareFieldTo(q, node.posCenter, node.posWeight, field);
+         if (node.negWeight != 0) inverseSquareFieldTo(q, node.negCenter, node.negWeight, field);
+         return;
+      }
+
+      bool leaf = true;
+      for (int c = 0; c < 8; c++) {
+         if (node.child[c] >= 0) {
+            leaf = false;
+            visitField(node.child[c], q, angleSq, field);
+         }
+      }
+      if (leaf) {
+         for (int k = node.lo; k < node.hi; k++) {
+            inverseSquareFieldTo(q, &pts[k * 3], wts[k], field);
+         }
+      }
+   }
+
+   double visit(int n, const double* q, double angleSq) const
+   {
+      const Node& node = nodes[n];
+
+      //far enough away, the whole cell acts as its two aggregate charges
+      double dx = node.center[0] - q[0];
+      double dy = node.center[1] - q[1];
+      double dz = node.center[2] - q[2];
+      double distSq = dx * dx + dy * dy + dz * dz;
+      if (node.size * node.size < angleSq * distSq) {
+         return inverseSquareTo(q, node.posCenter, node.posWeight)
+            + inverseSquareTo(q, node.negCenter, node.negWeight);
+      }
+
+      bool leaf = true;
+      double sum = 0;
+      for (int c = 0; c < 8; c++) {
+         if (node.child[c] >= 0) {
+            leaf = false;
+            sum += visit(node.child[c], q, angleSq);
+         }
+      }
+      if (leaf) {
+         for (int k = node.lo; k < node.hi; k++) {
+            sum += inverseSquareTo(q, &pts[k * 3], wts[k]);
+         }
+      }
+      return sum;
+   }
+
+   int count;
+   std::vector<Node> nodes;   //nodes[0] is the root
+   std::vector<double> pts;   //points in tree order
+   std::vector<double> wts;   //weights in tree order
+   std::vector<int> idx;      //original index of each point in tree order
+};
+
+#endif
@@ -0,0 +1,261 @@
+//
+//  File: pointcloud.cpp
+//
+//  Description:
+//    OBJ and PLY vertex reader/writer, see pointcloud.h.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+#include "pointcloud.h"
+
+static bool hasExtension(const char* path, const char* ext)
+{
+   size_t n = strlen(path), e = strlen(ext);
+   return n >= e && strcasecmp(path + n - e, ext) == 0;
+}
+
+//converts interleaved xyz triples into the planar layout
+static void toPlanar(const std::vector<double>& xyz, std::vector<double>& points, int* numPoints)
+{
+   int n = (int)(xyz.size() / 3);
+   points.resize(n * 3);
+   for (int i = 0; i < n; i++) {
+      points[i] = xyz[i * 3 + 0];
+      points[n + i] = xyz[i * 3 + 1];
+      points[2 * n + i] = xyz[i * 3 + 2];
+   }
+   *numPoints = n;
+}
+
+static bool readObj(FILE* file, std::vector<double>& xyz)
+{
+   char line[1024];
+   while (fgets(line, sizeof(line), file)) {
+      double x, y, z;
+      if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+         if (sscanf(line + 2, "%lf %lf %lf", &x, &y, &z) != 3) {
+            return false;
+         }
+         xyz.push_back(x);
+         xyz.push_back(y);
+         xyz.push_back(z);
+      }
+   }
+   return true;
+}
+
+//size in bytes of a PLY scalar type, 0 if unknown
+static int plyTypeSize(const char* type)
+{
+   if (!strcmp(type, "char") || !strcmp(type, "uchar") || !strcmp(type, "int8") || !strcmp(type, "uint8")) {
+      return 1;
+   }
+   if (!strcmp(type, "short") || !strcmp(type, "ushort") || !strcmp(type, "int16") || !strcmp(type, "uint16")) {
+      return 2;
+   }
+   if (!strcmp(type, "int") || !strcmp(type, "uint") || !strcmp(type, "int32") || !strcmp(type, "uint32")
+      || !strcmp(type, "float") || !strcmp(type, "float32")) {
+      return 4;
+   }
+   if (!strcmp(type, "double") || !strcmp(type, "float64")) {
+      return 8;
+   }
+   return 0;
+}
+
+static double plyValue(const unsigned char* data, const char* type)
+{
+   if (!strcmp(type, "float") || !strcmp(type, "float32")) {
+      float v; memcpy(&v, data, 4); return v;
+   }
+   if (!strcmp(type, "double") || !strcmp(type, "float64")) {
+      double v; memcpy(&v, data, 8); return v;
+   }
+   if (!strcmp(type, "int") || !strcmp(type, "int32")) {
+      int v; memcpy(&v, data, 4); return v;
+   }
+   if (!strcmp(type, "uint") || !strcmp(type, "uint32")) {
+      unsigned int v; memcpy(&v, data, 4); return v;
+   }
+   if (!strcmp(type, "short") || !strcmp(type, "int16")) {
+      short v; memcpy(&v, data, 2); return v;
+   }
+   if (!strcmp(type, "ushort") || !strcmp(type, "uint16")) {
+      unsigned short v; memcpy(&v, data, 2); return v;
+   }
+   if (!strcmp(type, "char") || !strcmp(type, "int8")) {
+      return (signed char)data[0];
+   }
+   return data[0];
+}
+
+static bool readPly(FILE* file, std::vector<double>& xyz)
+{
+   char line[1024], word[64], type[64], name[64];
+   bool binary = false, inVertex = false;
+   int numVertices = -1, recordSize = 0;
+   int offset[3] = {-1, -1, -1};
+   char types[3][64];
+   int numProperties = 0, column[3] = {-1, -1, -1};
+
+   if (!fgets(line, sizeof(line), file) || strncmp(line, "ply", 3) != 0) {
+      return false;
+   }
+   while (fgets(line, sizeof(line), file)) {
+      if (!strncmp(line, "end_header", 10)) {
+         break;
+      }
+      if (sscanf(line, "format %63s", word) == 1) {
+         if (!strcmp(word, "binary_little_endian")) {
+            binary = true;
+         } else if (strcmp(word, "ascii") != 0) {
+            printf("Unsupported PLY format %s\n", word);
+            return false;
+         }
+      } else if (sscanf(line, "element %63s", word) == 1) {
+         inVertex = !strcmp(word, "vertex");
+         if (inVertex) {
+            sscanf(line, "element %*s %d", &numVertices);
+         } else if (numVertices < 0) {
+            printf("PLY vertex element must come first\n");
+            return false;
+         }
+      } else if (inVertex && sscanf(line, "property %63s %63s", type, name) == 2) {
+         if (!strcmp(type, "list")) {
+            printf("Unsupported list property on PLY vertices\n");
+            return false;
+         }
+         //an unknown size would misplace every property after it
+         if (plyTypeSize(type) == 0) {
+            printf("Unsupported PLY property type %s\n", type);
+            return false;
+         }
+         int axis = !strcmp(name, "x") ? 0 : !strcmp(name, "y") ? 1 : !strcmp(name, "z") ? 2 : -1;
+         if (axis >= 0) {
+            offset[axis] = recordSize;
+            column[axis] = numProperties;
+            strcpy(types[axis], type);
+         }
+         recordSize += plyTypeSize(type);
+         numProperties++;
+      }
+   }
+   if (numVertices < 0 || offset[0] < 0 || offset[1] < 0 || offset[2] < 0) {
+      return false;
+   }
+
+   xyz.resize(numVertices * 3);
+   if (binary) {
+      std::vector<unsigned char> record(recordSize);
+      for (int i = 0; i < numVertices; i++) {
+         if (fread(&record[0], 1, recordSize, file) != (size_t)recordSize) {
+            return false;
+         }
+         for (int a = 0; a < 3; a++) {
+            xyz[i * 3 + a] = plyValue(&record[offset[a]], types[a]);
+         }
+      }
+   } else {
+      std::vector<double> values(numProperties);
+      for (int i = 0; i < numVertices; i++) {
+         for (int p = 0; p < numProperties; p++) {
+            if (fscanf(file, "%lf", &values[p]) != 1) {
+               return false;
+            }
+         }
+         for (int a = 0; a < 3; a++) {
+            xyz[i * 3 + a] = values[column[a]];
+         }
+      }
+   }
+   return true;
+}
+
+static bool writePly(FILE* file, const double* points, int numPoints)
+{
+   fprintf(file, "ply\nformat ascii 1.0\nelement vertex %d\n", numPoints);
+   fprintf(file, "property double x\nproperty double y\nproperty double z\nend_header\n");
+   for (int i = 0; i < numPoints; i++) {
+      fprintf(file, "%.17g %.17g %.17g\n", points[i], points[numPoints + i], points[2 * numPoints + i]);
+   }
+   return !ferror(file);
+}
+
+static bool writeObj(FILE* file, const double* points, int numPoints, const char* sourcePath)
+{
+   //copies the source .obj, replacing its vertex lines in order
+   FILE* source = sourcePath && hasExtension(sourcePath, ".obj") ? fopen(sourcePath, "r") : NULL;
+   int written = 0;
+   if (source) {
+      char line[1024];
+      while (fgets(line, sizeof(line), source)) {
+         if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t') && written < numPoints) {
+            fprintf(file, "v %.17g %.17g %.17g\n", points[written], points[numPoints + written],
+               points[2 * numPoints + written]);
+            written++;
+         } else {
+            fputs(line, file);
+         }
+      }
+      fclose(source);
+   }
+   for (; written < numPoints; written++) {
+      fprintf(file, "v %.17g %.17g %.17g\n", points[written], points[numPoints + written],
+         points[2 * numPoints + written]);
+   }
+
+   return !ferror(file);
+}
+
+bool readPointCloud(const char* path, std::vector<double>& points, int* numPoints)
+{
+   bool ply = hasExtension(path, ".ply");
+   if (!ply && !hasExtension(path, ".obj")) {
+      printf("Unknown point cloud format %s, expected .obj or .ply\n", path);
+      return false;
+   }
+
+   FILE* file = fopen(path, ply ? "rb" : "r");
+   if (!file) {
+      printf("Cannot open %s\n", path);
+      return false;
+   }
+
+   std::vector<double> xyz;
+   bool ok = ply ? readPly(file, xyz) : readObj(file, xyz);
+   fclose(file);
+   if (!ok) {
+      printf("Cannot parse %s\n", path);
+      return false;
+   }
+
+   toPlanar(xyz, points, numPoints);
+   return true;
+}
+
+bool writePointCloud(const char* path, const double* points, int numPoints, const char* sourcePath)
+{
+   //the points go to a file next to path that replaces it at the end, so
+   //path can also be the source the faces are copied from
+   std::string temporary = std::string(path) + ".tmp";
+   FILE* file = fopen(temporary.c_str(), "w");
+   if (!file) {
+      printf("Cannot write %s\n", path);
+      return false;
+   }
+
+   bool ok = hasExtension(path, ".ply") ? writePly(file, points, numPoints)
+      : writeObj(file, points, numPoints, sourcePath);
+   ok = fclose(file) == 0 && ok;
+   if (!ok || rename(temporary.c_str(), path) != 0) {
+      remove(temporary.c_str());
+      printf("Cannot write %s\n", path);
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,25 @@
+//
+//  File: pointcloud.h
+//
+//  Description:
+//    Minimal OBJ and PLY vertex reader/writer for the standalone magnet tools.
+//    Only vertex positions are read, points are returned planar like the
+//    buffers magnetcore.h works on.
+//
+
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <vector>
+
+//reads the vertex positions of an .obj or .ply file (ascii or binary little
+//endian), returns false and prints the reason on failure
+bool readPointCloud(const char* path, std::vector<double>& points, int* numPoints);
+
+//writes planar points to an .obj or ascii .ply file. When writing an .obj and
+//sourcePath is an .obj too, every line but the vertices is copied from it so
+//faces and groups survive the round trip. path is replaced only once the
+//whole file is written, so it may be sourcePath itself
+bool writePointCloud(const char* path, const double* points, int numPoints, const char* sourcePath);
+
+#endif
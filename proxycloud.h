@@ -0,0 +1,163 @@
+//
+//  File: proxycloud.h
+//
+//  Description:
+//    Level of detail proxy of a dense point set. The vertices are clustered
+//    once, and every evaluation after that only averages each cluster into
+//    one proxy point, so the kernel runs over a fraction of the vertices and
+//    the result is spread back to the vertices it stands for.
+//
+//    The clusters follow a Morton curve through the bounding box of the
+//    points, which keeps neighbouring vertices together, and the curve is cut
+//    into runs of equal length. Every proxy of a point set therefore stands
+//    for the same number of vertices, give or take one, and a plain mean over
+//    the proxies is the mean over the vertices. Only the vertex count is
+//    checked, the clusters are built again when it changes (a new topology)
+//    and are kept while the points only deform.
+//
+
+#ifndef PROXYCLOUD_H
+#define PROXYCLOUD_H
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+#include <vector>
+
+class ProxyCloud
+{
+public:
+   ProxyCloud() : numVertices(0), perProxy(0) {}
+
+   //clusters numPoints planar points, whose y and z values start stride
+   //values after the x ones, into proxies of about verticesPerProxy vertices
+   void build(const double* points, int numPoints, int stride, int verticesPerProxy)
+   {
+      numVertices = numPoints;
+      perProxy = verticesPerProxy;
+      order.resize(numPoints);
+      clusterStart.clear();
+      if (numPoints == 0) {
+         return;
+      }
+
+      double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX}, max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+      for (int i = 0; i < numPoints; i++) {
+         for (int a = 0; a < 3; a++) {
+            double v = points[a * stride + i];
+            min[a] = v < min[a] ? v : min[a];
+            max[a] = v > max[a] ? v : max[a];
+         }
+      }
+
+      //10 bits per axis, the vertices are sorted by their interleaved code
+      std::vector<std::pair<unsigned int, int> > codes(numPoints);
+      for (int i = 0; i < numPoints; i++) {
+         unsigned int code = 0;
+         for (int a = 0; a < 3; a++) {
+            double size = max[a] - min[a];
+            unsigned int cell = size > 0 ? (unsigned int)((points[a * stride + i] - min[a]) / size * 1023.0) : 0;
+            code |= spreadBits(cell) << a;
+         }
+         codes[i] = std::make_pair(code, i);
+      }
+      std::sort(codes.begin(), codes.end());
+      for (int i = 0; i < numPoints; i++) {
+         order[i] = codes[i].second;
+      }
+
+      //numProxies runs whose lengths differ by at most one
+      int numProxies = verticesPerProxy > 1 ? (numPoints + verticesPerProxy - 1) / verticesPerProxy : numPoints;
+      clusterStart.resize(numProxies + 1);
+      for (int c = 0; c <= numProxies; c++) {
+         clusterStart[c] = (int)((long long)c * numPoints / numProxies);
+      }
+   }
+
+   //whether the clusters were built for this vertex count and proxy size
+   bool built(int numPoints, int verticesPerProxy) const
+   {
+      return numVertices == numPoints && perProxy == verticesPerProxy;
+   }
+
+   //number of proxies
+   int size() const { return clusterStart.empty() ? 0 : (int)clusterStart.size() - 1; }
+
+   //number of vertices the clusters were built for
+   int vertices() const { return numVertices; }
+
+   //averages the planar points (laid out as for build) of every cluster into
+   //its proxy, proxies is planar as well with stride proxyStride
+   void gather(const double* points, int stride, double* proxies, int proxyStride) const
+   {
+      const int numProxies = size();
+      #pragma omp parallel for
+      for (int c = 0; c < numProxies; c++) {
+         double sum[3] = {0, 0, 0};
+         for (int j = clusterStart[c]; j < clusterStart[c + 1]; j++) {
+            int i = order[j];
+            sum[0] += points[i];
+            sum[1] += points[stride + i];
+            sum[2] += points[2 * stride + i];
+         }
+         double inv = 1.0 / (clusterStart[c + 1] - clusterStart[c]);
+         proxies[c] = sum[0] * inv;
+         proxies[proxyStride + c] = sum[1] * inv;
+         proxies[2 * proxyStride + c] = sum[2] * inv;
+      }
+   }
+
+   //sums a per vertex value over every cluster, so a charge spread over the
+   //vertices ends up on their proxy
+   void sum(const double* values, double* proxyValues) const
+   {
+      const int numProxies = size();
+      #pragma omp parallel for
+      for (int c = 0; c < numProxies; c++) {
+         double total = 0;
+         for (int j = clusterStart[c]; j < clusterStart[c + 1]; j++) {
+            total += values[order[j]];
+         }
+         proxyValues[c] = total;
+      }
+   }
+
+   //moves every vertex by how far its proxy moved from before to after, both
+   //planar with stride proxyStride, the points are laid out as for build
+   void scatter(const double* before, const double* after, int proxyStride, double* points, int stride) const
+   {
+      const int numProxies = size();
+      #pragma omp parallel for
+      for (int c = 0; c < numProxies; c++) {
+         double d[3];
+         for (int a = 0; a < 3; a++) {
+            d[a] = after[a * proxyStride + c] - before[a * proxyStride + c];
+         }
+         for (int j = clusterStart[c]; j < clusterStart[c + 1]; j++) {
+            int i = order[j];
+            points[i] += d[0];
+            points[stride + i] += d[1];
+            points[2 * stride + i] += d[2];
+         }
+      }
+   }
+
+private:
+   //spreads the low 10 bits of v two bits apart, for the Morton code
+   static unsigned int spreadBits(unsigned int v)
+   {
+      v &= 0x3ff;
+      v = (v | (v << 16)) & 0x030000ff;
+      v = (v | (v << 8)) & 0x0300f00f;
+      v = (v | (v << 4)) & 0x030c30c3;
+      v = (v | (v << 2)) & 0x09249249;
+      return v;
+   }
+
+   int numVertices;                //vertex count the clusters were built for
+   int perProxy;                   //vertices per proxy asked for
+   std::vector<int> order;         //vertex indices along the Morton curve
+   std::vector<int> clusterStart;  //first entry of order for every proxy, then numVertices
+};
+
+#endif
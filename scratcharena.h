@@ -0,0 +1,98 @@
+//
+//  File: scratcharena.h
+//
+//  Description:
+//    Bump allocator for the buffers one evaluation needs. Every allocation is
+//    64 byte aligned and lives until the next reset. When an evaluation asks
+//    for more than the arena holds, the extra requests get blocks of their
+//    own and the next reset grows the arena (at least doubling it) to cover
+//    them, so once the sizes settle an evaluation does no heap allocation.
+//
+
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <cstdlib>
+#include <vector>
+
+class ScratchArena
+{
+public:
+   enum { ALIGNMENT = 64 };
+
+   ScratchArena() : base(NULL), capacity(0), used(0), requested(0) {}
+
+   ~ScratchArena()
+   {
+      release();
+   }
+
+   //starts a new evaluation, everything allocated before becomes invalid
+   void reset()
+   {
+      if (!spills.empty()) {
+         size_t grown = capacity * 2 > requested ? capacity * 2 : requested;
+         release();
+         base = (char *)alignedAlloc(grown);
+         capacity = base ? grown : 0;
+      }
+      used = 0;
+      requested = 0;
+   }
+
+   //uninitialized room for count values of type T
+   template <typename T>
+   T* allocate(size_t count)
+   {
+      size_t bytes = (sizeof(T) * count + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+      requested += bytes;
+      if (used + bytes <= capacity) {
+         char* result = base + used;
+         used += bytes;
+         return (T *)result;
+      }
+      void* spill = alignedAlloc(bytes);
+      spills.push_back(spill);
+      return (T *)spill;
+   }
+
+   //bytes held by the arena itself, not counting blocks handed out past its end
+   size_t size() const
+   {
+      return capacity;
+   }
+
+   //frees everything, the arena starts over empty
+   void release()
+   {
+      for (size_t k = 0; k < spills.size(); k++) {
+         free(spills[k]);
+      }
+      spills.clear();
+      free(base);
+      base = NULL;
+      capacity = 0;
+      used = 0;
+   }
+
+private:
+   ScratchArena(const ScratchArena&);
+   ScratchArena& operator=(const ScratchArena&);
+
+   static void* alignedAlloc(size_t bytes)
+   {
+      void* result = NULL;
+      if (posix_memalign(&result, ALIGNMENT, bytes ? bytes : (size_t)ALIGNMENT) != 0) {
+         return NULL;
+      }
+      return result;
+   }
+
+   char* base;
+   size_t capacity;            //bytes at base
+   size_t used;                //bytes of base handed out since the last reset
+   size_t requested;           //bytes asked for since the last reset, spills included
+   std::vector<void*> spills;  //blocks handed out once base ran out
+};
+
+#endif
@@ -0,0 +1,149 @@
+//
+//  File: standinhost.h
+//
+//  Description:
+//    In memory MagnetHost, stands in for the data block, MFnMesh and
+//    MItGeometry so magnetpipeline.h runs without Maya. Meshes are held the
+//    way Maya holds them: points as interleaved floats, read without a copy,
+//    and outputs as x, y, z, w doubles like an MPointArray, so the copies
+//    the node makes cost the same here.
+//
+
+#ifndef STANDINHOST_H
+#define STANDINHOST_H
+
+#include <vector>
+
+#include "magnetpipeline.h"
+
+class StandInHost : public MagnetHost
+{
+public:
+   //adds a magnet from planar points, returns its number
+   int addMagnet(const double* points, int numPoints, double strength)
+   {
+      magnets.resize(magnets.size() + 1);
+      setPoints(magnets.back(), points, numPoints);
+      magnets.back().strength = strength;
+      return (int)magnets.size() - 1;
+   }
+
+   //adds an input geometry at the given logical index from planar points,
+   //returns its number
+   int addGeometry(unsigned int index, const double* points, int numPoints)
+   {
+      geometries.resize(geometries.size() + 1);
+      setPoints(geometries.back(), points, numPoints);
+      geometries.back().index = index;
+      return (int)geometries.size() - 1;
+   }
+
+   //replaces the points of magnet k, like a deforming mesh upstream would
+   void setMagnetPoints(int k, const double* points, int numPoints) { setPoints(magnets[k], points, numPoints); }
+
+   //starts an evaluation: every output becomes a copy of its input, the way
+   //the node's output handles are copied from the inputs before it runs
+   void pull()
+   {
+      for (size_t g = 0; g < geometries.size(); g++) {
+         Mesh& mesh = geometries[g];
+         int n = (int)mesh.points.size() / 3;
+         mesh.output.resize(4 * n);
+         for (int i = 0; i < n; i++) {
+            mesh.output[4 * i] = mesh.points[3 * i];
+            mesh.output[4 * i + 1] = mesh.points[3 * i + 1];
+            mesh.output[4 * i + 2] = mesh.points[3 * i + 2];
+            mesh.output[4 * i + 3] = 1;
+         }
+      }
+   }
+
+   //translation the host keeps for geometry g, what a saved scene would hold
+   const double* move(int g) const { return geometries[g].move; }
+
+   //output of geometry g as x, y, z, w per vertex
+   const double* output(int g, int* numPoints) const
+   {
+      *numPoints = (int)geometries[g].output.size() / 4;
+      return geometries[g].output.data();
+   }
+
+   //MagnetHost
+   int numMagnets() { return (int)magnets.size(); }
+
+   const float* magnetPoints(int k, int* numPoints)
+   {
+      *numPoints = (int)magnets[k].points.size() / 3;
+      return magnets[k].points.data();
+   }
+
+   double signedStrength(int k) { return magnets[k].strength; }
+
+   int numGeometries() { return (int)geometries.size(); }
+
+   unsigned int geometryIndex(int g) { return geometries[g].index; }
+
+   const float* geometryPoints(int g, int* numPoints)
+   {
+      *numPoints = (int)geometries[g].points.size() / 3;
+      return geometries[g].points.data();
+   }
+
+   void writePoints(int g, const double* x, const double* y, const double* z, int numPoints)
+   {
+      std::vector<double>& output = geometries[g].output;
+      output.resize(4 * numPoints);
+      double* out = output.data();
+      #pragma omp parallel for
+      for (int i = 0; i < numPoints; i++) {
+         out[4 * i] = x[i];
+         out[4 * i + 1] = y[i];
+         out[4 * i + 2] = z[i];
+         out[4 * i + 3] = 1;
+      }
+   }
+
+   bool storedMove(int g, double move[3])
+   {
+      for (int a = 0; a < 3; a++) {
+         move[a] = geometries[g].move[a];
+      }
+      return geometries[g].stored;
+   }
+
+   void writeMove(int g, const double move[3])
+   {
+      for (int a = 0; a < 3; a++) {
+         geometries[g].move[a] = move[a];
+      }
+      geometries[g].stored = true;
+   }
+
+private:
+   struct Mesh
+   {
+      Mesh() : strength(1), index(0), stored(false) { move[0] = move[1] = move[2] = 0; }
+
+      std::vector<float> points;   //interleaved xyz
+      double strength;             //magnets only
+      unsigned int index;          //geometries only
+      std::vector<double> output;  //geometries only, xyzw
+      double move[3];              //geometries only, see MagnetHost::storedMove
+      bool stored;                 //move was written
+   };
+
+   static void setPoints(Mesh& mesh, const double* points, int numPoints)
+   {
+      mesh.points.resize(3 * numPoints);
+      for (int i = 0; i < numPoints; i++) {
+         mesh.points[3 * i] = (float)points[i];
+         mesh.points[3 * i + 1] = (float)points[numPoints + i];
+         mesh.points[3 * i + 2] = (float)points[2 * numPoints + i];
+      }
+   }
+
+   std::vector<Mesh> magnets;
+   std::vector<Mesh> geometries;
+};
+
+#endif